@@ -0,0 +1,260 @@
+// =====================================
+// CraneScheduler - Assignment 4
+// runs a batch of ship operations with several cranes at once
+// =====================================
+#pragma once
+
+#include "Ship.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace shipping {
+template <typename Container> struct CraneOperation {
+  enum class Kind { Load, Unload, Move };
+  Kind kind;
+  X x;
+  Y y;
+  X to_x{0};
+  Y to_y{0};
+  std::optional<Container> container;
+  // crane time of the operation, in any unit, used for the makespan
+  int duration = 1;
+
+  static CraneOperation load(X x, Y y, Container c, int duration = 1) {
+    return {Kind::Load, x, y, X{0}, Y{0}, std::move(c), duration};
+  }
+  static CraneOperation unload(X x, Y y, int duration = 1) {
+    return {Kind::Unload, x, y, X{0}, Y{0}, std::nullopt, duration};
+  }
+  static CraneOperation move(X from_x, Y from_y, X to_x, Y to_y,
+                             int duration = 1) {
+    return {Kind::Move, from_x, from_y, to_x, to_y, std::nullopt, duration};
+  }
+};
+
+template <typename Container> struct CraneSchedule {
+  // all by operation index
+  std::vector<std::vector<size_t>> dependencies;
+  std::vector<int> start_times;
+  std::vector<std::optional<Container>> unloaded;
+  std::vector<std::optional<BadShipOperationException>> errors;
+  // planned finish time of the last operation, in operation duration units
+  int makespan = 0;
+  // of applying the batch to the ship
+  std::chrono::nanoseconds wall_time{0};
+};
+
+// Operations touching the same column keep their batch order (the column is
+// a LIFO stack), a move joins the chains of its two columns, and with
+// segregation constraints so do columns within the largest constraint
+// distance; everything else is independent. The plan gives each ready
+// operation to whichever crane is free, and run executes the chains the same
+// way on the pool, one worker per crane: an operation is submitted once the
+// operations it depends on are done. Each works on its own columns, while
+// the state all columns share (group, region and segregation indexes,
+// streams, the group cache) is updated under one ship wide lock, grouping
+// and measure functions included; these and the height function must be
+// safe to call from several threads. The ship ends up as if the batch were
+// applied in order, but group and position stream events of independent
+// operations may be interleaved in any order. A traced ship runs the batch
+// in order on the calling thread, so the trace replays. An operation that
+// throws is recorded in errors and the rest still run.
+template <typename Container> class CraneScheduler {
+  ThreadPool pool_;
+
+  // reach: columns up to this far apart also interact (segregation
+  // constraints), -1 for none
+  static std::vector<std::vector<size_t>>
+  build_dependencies(const std::vector<CraneOperation<Container>> &operations,
+                     int reach) {
+    std::vector<std::vector<size_t>> dependencies(operations.size());
+    std::unordered_map<Position, size_t> last_on_column;
+    auto depend_on_columns = [&](size_t op, X x, Y y) {
+      int r = std::max(reach, 0);
+      for (int dx = -r; dx <= r; ++dx) {
+        for (int dy = -r; dy <= r; ++dy) {
+          auto itr = last_on_column.find(Position{X{x + dx}, Y{y + dy}});
+          if (itr == last_on_column.end() || itr->second == op) {
+            continue;
+          }
+          auto &deps = dependencies[op];
+          if (std::find(deps.begin(), deps.end(), itr->second) == deps.end()) {
+            deps.push_back(itr->second);
+          }
+        }
+      }
+    };
+    for (size_t op = 0; op < operations.size(); ++op) {
+      const auto &operation = operations[op];
+      bool move = operation.kind == CraneOperation<Container>::Kind::Move;
+      depend_on_columns(op, operation.x, operation.y);
+      if (move) {
+        depend_on_columns(op, operation.to_x, operation.to_y);
+      }
+      last_on_column[Position{operation.x, operation.y}] = op;
+      if (move) {
+        last_on_column[Position{operation.to_x, operation.to_y}] = op;
+      }
+    }
+    return dependencies;
+  }
+
+  // list scheduling on `cranes` cranes, longest remaining path first
+  static int plan(const std::vector<CraneOperation<Container>> &operations,
+                  const std::vector<std::vector<size_t>> &dependencies,
+                  const std::vector<std::vector<size_t>> &successors,
+                  size_t cranes, std::vector<int> &start_times) {
+    size_t n = operations.size();
+    // dependencies always point backwards, so reverse index order is a
+    // reverse topological order
+    std::vector<int> remaining_path(n, 0);
+    for (size_t op = n; op-- > 0;) {
+      int longest = 0;
+      for (auto next : successors[op]) {
+        longest = std::max(longest, remaining_path[next]);
+      }
+      remaining_path[op] = longest + operations[op].duration;
+    }
+    auto by_path = [&](size_t a, size_t b) {
+      return remaining_path[a] < remaining_path[b] ||
+             (remaining_path[a] == remaining_path[b] && a > b);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(by_path)> ready(
+        by_path);
+    using Finish = std::pair<int, size_t>;
+    std::priority_queue<Finish, std::vector<Finish>, std::greater<Finish>>
+        running;
+    std::vector<size_t> missing(n);
+    for (size_t op = 0; op < n; ++op) {
+      missing[op] = dependencies[op].size();
+      if (missing[op] == 0) {
+        ready.push(op);
+      }
+    }
+    start_times.assign(n, 0);
+    int now = 0;
+    int makespan = 0;
+    while (!ready.empty() || !running.empty()) {
+      while (!ready.empty() && running.size() < cranes) {
+        size_t op = ready.top();
+        ready.pop();
+        start_times[op] = now;
+        running.push({now + operations[op].duration, op});
+      }
+      auto [finish, op] = running.top();
+      running.pop();
+      now = finish;
+      makespan = std::max(makespan, finish);
+      for (auto next : successors[op]) {
+        if (--missing[next] == 0) {
+          ready.push(next);
+        }
+      }
+    }
+    return makespan;
+  }
+
+  static void apply(Ship<Container> &ship,
+                    CraneOperation<Container> &operation,
+                    CraneSchedule<Container> &schedule, size_t op) {
+    using Kind = typename CraneOperation<Container>::Kind;
+    try {
+      switch (operation.kind) {
+      case Kind::Load:
+        ship.load(operation.x, operation.y, std::move(*operation.container));
+        break;
+      case Kind::Unload:
+        schedule.unloaded[op] = ship.unload(operation.x, operation.y);
+        break;
+      case Kind::Move:
+        ship.move(operation.x, operation.y, operation.to_x, operation.to_y);
+        break;
+      }
+    } catch (const BadShipOperationException &e) {
+      schedule.errors[op] = e;
+    }
+  }
+
+  // runs every operation once all its dependencies are done
+  void execute(Ship<Container> &ship,
+               std::vector<CraneOperation<Container>> &operations,
+               const std::vector<std::vector<size_t>> &successors,
+               CraneSchedule<Container> &schedule) {
+    size_t n = operations.size();
+    std::mutex shared_m;
+    struct ResetShared {
+      Ship<Container> &ship;
+      ~ResetShared() { ship.shared_m_ = nullptr; }
+    } shared{ship};
+    ship.shared_m_ = &shared_m;
+
+    std::unique_ptr<std::atomic<size_t>[]> missing(new std::atomic<size_t>[n]);
+    for (size_t op = 0; op < n; ++op) {
+      missing[op] = schedule.dependencies[op].size();
+    }
+    TaskGroup chains;
+    std::function<void(size_t)> run_op = [&](size_t op) {
+      apply(ship, operations[op], schedule, op);
+      for (auto next : successors[op]) {
+        if (--missing[next] == 0) {
+          pool_.submit(chains, [&run_op, next] { run_op(next); });
+        }
+      }
+    };
+    for (size_t op = 0; op < n; ++op) {
+      if (schedule.dependencies[op].empty()) {
+        pool_.submit(chains, [&run_op, op] { run_op(op); });
+      }
+    }
+    pool_.wait(chains);
+  }
+
+public:
+  explicit CraneScheduler(
+      size_t cranes = std::max(1u, std::thread::hardware_concurrency()))
+      : pool_(std::max<size_t>(cranes, 1)) {}
+
+  size_t cranes() const { return pool_.size(); }
+
+  CraneSchedule<Container>
+  run(Ship<Container> &ship,
+      std::vector<CraneOperation<Container>> operations) {
+    size_t n = operations.size();
+    CraneSchedule<Container> schedule;
+    schedule.dependencies =
+        build_dependencies(operations, ship.segregationDistance());
+    schedule.unloaded.resize(n);
+    schedule.errors.resize(n);
+    std::vector<std::vector<size_t>> successors(n);
+    for (size_t op = 0; op < n; ++op) {
+      for (auto dep : schedule.dependencies[op]) {
+        successors[dep].push_back(op);
+      }
+    }
+    schedule.makespan = plan(operations, schedule.dependencies, successors,
+                             pool_.size(), schedule.start_times);
+
+    auto started = std::chrono::steady_clock::now();
+    if (ship.trace_ || pool_.size() == 1) {
+      // batch order is a dependency order
+      for (size_t op = 0; op < n; ++op) {
+        apply(ship, operations[op], schedule, op);
+      }
+    } else {
+      execute(ship, operations, successors, schedule);
+    }
+    schedule.wall_time = std::chrono::steady_clock::now() - started;
+    return schedule;
+  }
+};
+} // namespace shipping
@@ -0,0 +1,120 @@
+// =====================================
+// DeltaStream - Assignment 4
+// insert/remove notifications for group and position views
+// =====================================
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace shipping {
+enum class DeltaKind : std::uint8_t { Insert, Remove };
+
+struct DeltaEvent {
+  std::uint64_t sequence;
+  DeltaKind kind;
+  int x;
+  int y;
+  int z;
+};
+
+// Fixed size ring of events, one writer (the ship) and any number of lock
+// free readers, each with its own cursor. Every slot is a small seqlock: a
+// reader that gets lapped by the writer sees the slot sequence change and
+// reports the loss instead of returning a torn event.
+class DeltaStream {
+  struct Slot {
+    // sequence + 1 of the event held, 0 while empty or being written
+    std::atomic<std::uint64_t> sequence{0};
+    std::atomic<std::uint64_t> payload{0};
+  };
+  static constexpr int coordinate_bits = 21;
+  static constexpr std::uint64_t coordinate_mask =
+      (std::uint64_t{1} << coordinate_bits) - 1;
+
+  std::unique_ptr<Slot[]> slots_;
+  std::uint64_t capacity_;
+  std::atomic<std::uint64_t> published_{0};
+
+  static std::uint64_t pack(DeltaKind kind, int x, int y, int z) {
+    return (std::uint64_t(kind) << (3 * coordinate_bits)) |
+           ((std::uint64_t(x) & coordinate_mask) << (2 * coordinate_bits)) |
+           ((std::uint64_t(y) & coordinate_mask) << coordinate_bits) |
+           (std::uint64_t(z) & coordinate_mask);
+  }
+  static DeltaEvent unpack(std::uint64_t sequence, std::uint64_t payload) {
+    return {sequence, DeltaKind(payload >> (3 * coordinate_bits)),
+            int((payload >> (2 * coordinate_bits)) & coordinate_mask),
+            int((payload >> coordinate_bits) & coordinate_mask),
+            int(payload & coordinate_mask)};
+  }
+
+public:
+  explicit DeltaStream(std::size_t capacity = 1024)
+      : slots_(new Slot[capacity ? capacity : 1]),
+        capacity_(capacity ? capacity : 1) {}
+
+  // writer side, single threaded
+  void publish(DeltaKind kind, int x, int y, int z) {
+    std::uint64_t sequence = published_.load(std::memory_order_relaxed);
+    Slot &slot = slots_[sequence % capacity_];
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.payload.store(pack(kind, x, y, z), std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_release);
+    published_.store(sequence + 1, std::memory_order_release);
+  }
+
+  // sequence the next published event will get
+  std::uint64_t head() const {
+    return published_.load(std::memory_order_acquire);
+  }
+
+  // appends the events in [cursor, head) to out and advances cursor to head;
+  // false if some of them were already overwritten - cursor still moves to
+  // head and the reader should rescan the view it follows
+  bool read(std::uint64_t &cursor, std::vector<DeltaEvent> &out) const {
+    std::uint64_t head = this->head();
+    if (head - cursor > capacity_) {
+      cursor = head;
+      return false;
+    }
+    std::size_t first_new = out.size();
+    for (; cursor != head; ++cursor) {
+      const Slot &slot = slots_[cursor % capacity_];
+      std::uint64_t before = slot.sequence.load(std::memory_order_acquire);
+      std::uint64_t payload = slot.payload.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      std::uint64_t after = slot.sequence.load(std::memory_order_relaxed);
+      if (before != cursor + 1 || after != before) {
+        out.resize(first_new);
+        cursor = this->head();
+        return false;
+      }
+      out.push_back(unpack(cursor, payload));
+    }
+    return true;
+  }
+};
+
+// a reader's cursor into a stream; a default constructed (or unknown
+// grouping) subscription never receives events
+class DeltaSubscription {
+  std::shared_ptr<const DeltaStream> stream_;
+  std::uint64_t cursor_ = 0;
+
+public:
+  DeltaSubscription() {}
+  explicit DeltaSubscription(std::shared_ptr<const DeltaStream> stream)
+      : stream_(std::move(stream)), cursor_(stream_->head()) {}
+
+  // appends the events since the last poll, see DeltaStream::read
+  bool poll(std::vector<DeltaEvent> &out) {
+    return stream_ ? stream_->read(cursor_, out) : true;
+  }
+  // sequence of the next event this subscription will see
+  std::uint64_t sequence() const { return cursor_; }
+};
+} // namespace shipping
@@ -6,6 +6,9 @@
 //-------------------------------------
 // ExamHall.h
 //-------------------------------------
+#include "Grid.h"
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include <unordered_map>
 #include <tuple>
@@ -42,7 +45,7 @@ namespace std
     {
         std::size_t operator()(const exams::Position& pos) const noexcept
         {
-            return std::get<0>(pos) ^ (std::get<1>(pos) << 1);
+            return grid::packed_key<2>({std::get<0>(pos), std::get<1>(pos)});
         }
     };
 }
@@ -64,6 +67,8 @@ namespace exams {
     template<typename Examinee>
     using Grouping = std::unordered_map<std::string, std::function<std::string(const Examinee&)>>;
 
+    enum class Neighborhood { Four, Eight };
+
     template<typename Examinee>
     class ExamHall {
         class GroupView {
@@ -104,18 +109,75 @@ namespace exams {
             }
         };
 
-        std::vector<std::optional<Examinee>> examinees;
-        int x_size;
-        int y_size;
+        // dense set of seats (storage indices), O(1) insert, erase and pick
+        class SeatSet {
+            std::vector<size_t> seats;
+            std::vector<int> slot_of; // -1 if not in the set
+        public:
+            explicit SeatSet(size_t cells = 0): slot_of(cells, -1) {}
+            void insert(size_t seat) {
+                if(slot_of[seat] < 0) {
+                    slot_of[seat] = seats.size();
+                    seats.push_back(seat);
+                }
+            }
+            void erase(size_t seat) {
+                if(slot_of[seat] >= 0) {
+                    size_t last = seats.back();
+                    seats[slot_of[seat]] = last;
+                    slot_of[last] = slot_of[seat];
+                    seats.pop_back();
+                    slot_of[seat] = -1;
+                }
+            }
+            bool empty() const { return seats.empty(); }
+            size_t any() const { return seats.back(); }
+            auto begin() const { return seats.begin(); }
+            auto end() const { return seats.end(); }
+        };
+        using SeatPair = std::pair<Position, Position>;
+        class PairsView {
+            const std::vector<SeatPair>* p_pairs = nullptr;
+            using iterator_type = typename std::vector<SeatPair>::const_iterator;
+        public:
+            PairsView(const std::vector<SeatPair>& pairs): p_pairs(&pairs) {}
+            PairsView(int) {}
+            auto begin() const {
+                return p_pairs? p_pairs->begin(): iterator_type{};
+            }
+            auto end() const {
+                return p_pairs? p_pairs->end(): iterator_type{};
+            }
+        };
+        // one group under one neighborhood, kept up to date on every sit/unsit
+        struct NeighborhoodStencil {
+            std::unordered_map<size_t, unsigned char> counts; // group members around a seat, only seats that have some
+            std::optional<SeatSet> lonely_seats; // empty seats with no count, once the group was asked for one
+            std::vector<SeatPair> pairs; // adjacent members
+            std::unordered_map<std::uint64_t, size_t> pair_slot;
+        };
+        struct GroupStencil {
+            NeighborhoodStencil by_neighborhood[2]; // by Neighborhood
+        };
+        struct GroupingStencils {
+            std::unordered_map<std::string, GroupStencil> by_group;
+            std::vector<GroupStencil*> seat_group; // null for an empty seat
+            std::vector<NeighborhoodStencil*> with_lonely_seats;
+        };
+
+        grid::Grid<std::optional<Examinee>, 2> examinees;
         Grouping<Examinee> groupingFunctions;
         using Pos2Examinee = std::unordered_map<Position, const Examinee&>;
         using Group = std::unordered_map<std::string, Pos2Examinee>;
         // all groupings by their grouping name
         mutable std::unordered_map<std::string, Group> groups;
+        // only groupings that were tracked or queried, see trackNeighborhoods
+        mutable std::unordered_map<std::string, GroupingStencils> stencils;
+        SeatSet empty_seats;
         // private method
-        int pos_index(X x, Y y) const { 
-            if(x >= 0 && x < x_size && y >= 0 && y < y_size) {
-                return y * x_size + x;
+        size_t pos_index(X x, Y y) const { 
+            if(examinees.contains({x, y})) {
+                return examinees.index({x, y});
             }
             throw BadPositionException(x, y, "index out of range");
         }
@@ -125,18 +187,134 @@ namespace exams {
         void addExamineeToGroups(X x, Y y) {
             Examinee& e = get_examinee(x, y);
             for(auto& group_pair: groupingFunctions) {
-                groups[group_pair.first][group_pair.second(e)].insert( { std::tuple{x, y}, e } );
+                std::string group_name = group_pair.second(e);
+                groups[group_pair.first][group_name].insert( { std::tuple{x, y}, e } );
+                auto stencils_itr = stencils.find(group_pair.first);
+                if(stencils_itr != stencils.end()) {
+                    addExamineeToStencils(stencils_itr->second, group_name, x, y);
+                }
             }
         }
         void removeExamineeFromGroups(X x, Y y) {
             Examinee& e = get_examinee(x, y);
             for(auto& group_pair: groupingFunctions) {
                 groups[group_pair.first][group_pair.second(e)].erase(std::tuple{x, y});
+                auto stencils_itr = stencils.find(group_pair.first);
+                if(stencils_itr != stencils.end()) {
+                    removeExamineeFromStencils(stencils_itr->second, x, y);
+                }
             }            
         }
+        static std::uint64_t pair_key(size_t seat1, size_t seat2) {
+            return (std::uint64_t(std::min(seat1, seat2)) << 32) | std::max(seat1, seat2);
+        }
+        Position position_of(size_t seat) const {
+            auto coordinates = examinees.coordinates(seat);
+            return Position{X{coordinates[0]}, Y{coordinates[1]}};
+        }
+        // a new group has no members yet, so no counts and no pairs
+        GroupStencil& stencil_of(GroupingStencils& grouping_stencils, const std::string& groupName) const {
+            return grouping_stencils.by_group[groupName];
+        }
+        // the stencils of a grouping with a function, built from the seated examinees on first use
+        GroupingStencils& stencils_of(const std::string& groupingName) const {
+            auto [itr, created] = stencils.try_emplace(groupingName);
+            if(created) {
+                const auto& groupingFunction = groupingFunctions.at(groupingName);
+                itr->second.seat_group.resize(examinees.size(), nullptr);
+                for(size_t seat = 0; seat < examinees.size(); ++seat) {
+                    if(examinees[seat]) {
+                        auto [x, y] = position_of(seat);
+                        addExamineeToStencils(itr->second, groupingFunction(*examinees[seat]), x, y);
+                    }
+                }
+            }
+            return itr->second;
+        }
+        NeighborhoodStencil& lonely_seats_of(GroupingStencils& grouping_stencils, const std::string& groupName,
+                                             Neighborhood neighborhood) const {
+            auto& stencil = stencil_of(grouping_stencils, groupName).by_neighborhood[int(neighborhood)];
+            if(!stencil.lonely_seats) {
+                // from the first query on, sit/unsit keep the group's lonely seats up to date
+                stencil.lonely_seats.emplace(examinees.size());
+                for(size_t seat: empty_seats) {
+                    if(stencil.counts.find(seat) == stencil.counts.end()) {
+                        stencil.lonely_seats->insert(seat);
+                    }
+                }
+                grouping_stencils.with_lonely_seats.push_back(&stencil);
+            }
+            return stencil;
+        }
+        // seat is already taken, and out of empty_seats
+        void addExamineeToStencils(GroupingStencils& grouping_stencils, const std::string& groupName, X x, Y y) const {
+            size_t seat = pos_index(x, y);
+            for(auto* stencil: grouping_stencils.with_lonely_seats) {
+                stencil->lonely_seats->erase(seat);
+            }
+            GroupStencil& group_stencil = stencil_of(grouping_stencils, groupName);
+            grouping_stencils.seat_group[seat] = &group_stencil;
+            examinees.for_each_neighbor({x, y}, 1, false, [&](const grid::Coordinates<2>& at, const auto&) {
+                size_t neighbor = examinees.index(at);
+                bool orthogonal = at[0] == x || at[1] == y;
+                for(int n = orthogonal? 0: 1; n < 2; ++n) {
+                    auto& stencil = group_stencil.by_neighborhood[n];
+                    if(stencil.counts[neighbor]++ == 0 && stencil.lonely_seats) {
+                        stencil.lonely_seats->erase(neighbor);
+                    }
+                    if(grouping_stencils.seat_group[neighbor] == &group_stencil) {
+                        stencil.pair_slot[pair_key(seat, neighbor)] = stencil.pairs.size();
+                        stencil.pairs.push_back({position_of(seat), position_of(neighbor)});
+                    }
+                }
+            });
+        }
+        // seat is still taken, it is emptied right after
+        void removeExamineeFromStencils(GroupingStencils& grouping_stencils, X x, Y y) {
+            size_t seat = pos_index(x, y);
+            GroupStencil* group_stencil = grouping_stencils.seat_group[seat];
+            grouping_stencils.seat_group[seat] = nullptr;
+            examinees.for_each_neighbor({x, y}, 1, false, [&](const grid::Coordinates<2>& at, const auto& neighbor_examinee) {
+                size_t neighbor = examinees.index(at);
+                bool orthogonal = at[0] == x || at[1] == y;
+                for(int n = orthogonal? 0: 1; n < 2; ++n) {
+                    auto& stencil = group_stencil->by_neighborhood[n];
+                    auto count = stencil.counts.find(neighbor);
+                    if(--count->second == 0) {
+                        stencil.counts.erase(count);
+                        if(!neighbor_examinee && stencil.lonely_seats) {
+                            stencil.lonely_seats->insert(neighbor);
+                        }
+                    }
+                    if(grouping_stencils.seat_group[neighbor] == group_stencil) {
+                        auto itr = stencil.pair_slot.find(pair_key(seat, neighbor));
+                        size_t slot = itr->second;
+                        stencil.pair_slot.erase(itr);
+                        if(slot + 1 != stencil.pairs.size()) {
+                            stencil.pairs[slot] = stencil.pairs.back();
+                            const auto& moved = stencil.pairs[slot];
+                            stencil.pair_slot[pair_key(pos_index(std::get<0>(moved.first), std::get<1>(moved.first)),
+                                                       pos_index(std::get<0>(moved.second), std::get<1>(moved.second)))] = slot;
+                        }
+                        stencil.pairs.pop_back();
+                    }
+                }
+            });
+            for(auto* stencil: grouping_stencils.with_lonely_seats) {
+                if(stencil->counts.find(seat) == stencil->counts.end()) {
+                    stencil->lonely_seats->insert(seat);
+                }
+            }
+        }
     public:
         ExamHall(X x, Y y, Grouping<Examinee> groupingFunctions) noexcept
-        : examinees(x*y), x_size(x), y_size(y), groupingFunctions(std::move(groupingFunctions)) {}
+        : examinees({x, y}), groupingFunctions(std::move(groupingFunctions)), empty_seats(examinees.size()) {
+            for(int seat_y = 0; seat_y < y; ++seat_y) {
+                for(int seat_x = 0; seat_x < x; ++seat_x) {
+                    empty_seats.insert(examinees.index({seat_x, seat_y}));
+                }
+            }
+        }
 
         void sit(X x, Y y, Examinee e) noexcept(false) {
             auto& seat = examinees[pos_index(x, y)];
@@ -144,6 +322,7 @@ namespace exams {
                 throw BadPositionException(x, y, "occupied sit");
             }
             seat = std::move(e);
+            empty_seats.erase(pos_index(x, y));
             addExamineeToGroups(x, y);
         }
 
@@ -157,6 +336,7 @@ namespace exams {
             // swap empty seat with real examinee and return the real examinee
             // might be more efficient than creating a temp copy
             std::swap(seat, examinee); // seat would become empty, examinee would get the real examinee
+            empty_seats.insert(pos_index(x, y));
             return examinee.value();
         }
         void move(X from_x, Y from_y, X to_x, Y to_y) noexcept(false) {
@@ -197,6 +377,55 @@ namespace exams {
             return GroupView { 0 };
         }
 
+        // Neighborhood queries of a grouping are answered from stencils kept up to date on every sit/unsit
+        // from then on. Builds them now rather than on the first query; groupings that are neither
+        // tracked nor queried cost sit/unsit nothing.
+        void trackNeighborhoods(const std::string& groupingName) {
+            if(groupingFunctions.find(groupingName) != groupingFunctions.end()) {
+                stencils_of(groupingName);
+            }
+        }
+
+        // same group examinees around (x, y) - O(1), kept up to date on sit/unsit
+        size_t countNeighborsByGroup(X x, Y y, const std::string& groupingName, const std::string& groupName,
+                                     Neighborhood neighborhood = Neighborhood::Eight) const {
+            size_t seat = pos_index(x, y);
+            if(groupingFunctions.find(groupingName) == groupingFunctions.end()) {
+                return 0;
+            }
+            auto& grouping_stencils = stencils_of(groupingName);
+            auto group_itr = grouping_stencils.by_group.find(groupName);
+            if(group_itr == grouping_stencils.by_group.end()) {
+                return 0;
+            }
+            const auto& counts = group_itr->second.by_neighborhood[int(neighborhood)].counts;
+            auto count = counts.find(seat);
+            return count != counts.end()? count->second: 0;
+        }
+
+        // every pair of adjacent examinees of the group, each pair once - in some undefined order
+        PairsView getAdjacentPairsByGroup(const std::string& groupingName, const std::string& groupName,
+                                          Neighborhood neighborhood = Neighborhood::Eight) const {
+            if(groupingFunctions.find(groupingName) == groupingFunctions.end()) {
+                return PairsView { 0 };
+            }
+            auto& group_stencil = stencil_of(stencils_of(groupingName), groupName);
+            return PairsView { group_stencil.by_neighborhood[int(neighborhood)].pairs };
+        }
+
+        // an empty seat with no examinee of the group around it - O(1)
+        std::optional<Position> findSeatWithNoGroupNeighbor(const std::string& groupingName, const std::string& groupName,
+                                                            Neighborhood neighborhood = Neighborhood::Eight) const {
+            if(groupingFunctions.find(groupingName) == groupingFunctions.end()) {
+                return std::nullopt;
+            }
+            const auto& lonely_seats = *lonely_seats_of(stencils_of(groupingName), groupName, neighborhood).lonely_seats;
+            if(lonely_seats.empty()) {
+                return std::nullopt;
+            }
+            return position_of(lonely_seats.any());
+        }
+
         iterator begin() const {
             return { examinees.begin(), examinees.end() };
         }
@@ -476,6 +705,48 @@ void creating_view_on_empty_hall() {
     }
 }
 
+void stencil_queries() {
+	Grouping<std::string> groupingFunctions = {
+		{ "first_letter",
+			[](const std::string& s){ return std::string(1, s[0]); }
+		}
+	};
+    ExamHall<std::string> examHall{ X{3}, Y{3}, groupingFunctions };
+	// kept up to date from here on; without it built on the first query
+	examHall.trackNeighborhoods("first_letter");
+	examHall.sit(X{0}, Y{0}, "galit");
+	examHall.sit(X{1}, Y{1}, "goni");
+	examHall.sit(X{1}, Y{0}, "dana");
+
+    // diagonal neighbors are adjacent only in the 8-neighborhood
+    if(examHall.countNeighborsByGroup(X{0}, Y{0}, "first_letter", "g", Neighborhood::Four) != 0 ||
+       examHall.countNeighborsByGroup(X{0}, Y{0}, "first_letter", "g", Neighborhood::Eight) != 1) {
+        std::cout << "failed neighbor count test" << std::endl;
+    }
+
+	// loop on adjacent "g" pairs: {X{0}, Y{0}} - {X{1}, Y{1}} in some order
+	for(const auto& pair : examHall.getAdjacentPairsByGroup("first_letter", "g")) {
+        std::cout << "X{" << std::get<0>(pair.first) << "}, Y{" << std::get<1>(pair.first) << "} - "
+                  << "X{" << std::get<0>(pair.second) << "}, Y{" << std::get<1>(pair.second) << "}" << std::endl;
+    }
+
+    // every empty seat touches galit or goni
+    if(examHall.findSeatWithNoGroupNeighbor("first_letter", "g")) {
+        std::cout << "failed no lonely seat test" << std::endl;
+    }
+    examHall.unsit(X{1}, Y{1}); // unsit goni
+    auto seat = examHall.findSeatWithNoGroupNeighbor("first_letter", "g");
+    if(!seat || examHall.countNeighborsByGroup(std::get<0>(*seat), std::get<1>(*seat), "first_letter", "g") != 0) {
+        std::cout << "failed lonely seat test" << std::endl;
+    }
+    // the lonely seats of "g" are tracked since the query above
+    examHall.sit(X{1}, Y{1}, "gil");
+    if(examHall.findSeatWithNoGroupNeighbor("first_letter", "g")) {
+        std::cout << "failed lonely seat after sit test" << std::endl;
+    }
+    std::cout << std::endl;
+}
+
 void test_copy_ctor_assignment_move() {
     if constexpr(!std::is_copy_constructible_v<ExamHall<std::string>>) {
         std::cout << "copy ctor is blocked - check if there is a reason for that" << std::endl;
@@ -524,5 +795,6 @@ int main() {
 	bad_cases();
 	simple_happy_path();	
 	creating_view_on_empty_hall();
+	stencil_queries();
 	test_copy_ctor_assignment_move();
 }
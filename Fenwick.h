@@ -0,0 +1,109 @@
+// =====================================
+// Fenwick - Assignment 4
+// 3D binary indexed tree backing the Ship region queries
+// =====================================
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+namespace shipping {
+// sums over axis aligned boxes of a x*y*z grid, O(log x * log y * log z) for
+// both point update and box query
+template <typename T> class FenwickTree3D {
+  int nx_ = 0;
+  int ny_ = 0;
+  int nz_ = 0;
+  std::vector<T> tree_;
+
+  // i, j, k are 1-based tree indices
+  T &node(int i, int j, int k) {
+    return tree_[((k - 1) * ny_ + (j - 1)) * nx_ + (i - 1)];
+  }
+  const T &node(int i, int j, int k) const {
+    return tree_[((k - 1) * ny_ + (j - 1)) * nx_ + (i - 1)];
+  }
+
+  // sum of nodes (i, j, *) over z in (0, k]
+  T z_prefix(int i, int j, int k) const {
+    T result{};
+    for (; k > 0; k -= k & -k) {
+      result += node(i, j, k);
+    }
+    return result;
+  }
+
+public:
+  FenwickTree3D() = default;
+  FenwickTree3D(int nx, int ny, int nz)
+      : nx_(nx), ny_(ny), nz_(nz),
+        tree_(static_cast<size_t>(nx) * ny * nz, T{}) {}
+
+  int z_size() const { return nz_; }
+
+  // extends the z extent to nz, keeping every sum; O(x * y * log z) per new
+  // z, the new ones being empty
+  void grow_z(int nz) {
+    if (nz <= nz_) {
+      return;
+    }
+    int old_nz = nz_;
+    tree_.resize(static_cast<size_t>(nx_) * ny_ * nz, T{});
+    nz_ = nz;
+    for (int k = old_nz + 1; k <= nz; ++k) {
+      // node k covers z in (k - lowbit(k), k], only part of it was there
+      int from = k - (k & -k);
+      if (from >= old_nz) {
+        continue;
+      }
+      for (int i = 1; i <= nx_; ++i) {
+        for (int j = 1; j <= ny_; ++j) {
+          node(i, j, k) = z_prefix(i, j, old_nz) - z_prefix(i, j, from);
+        }
+      }
+    }
+  }
+
+  void add(int x, int y, int z, T delta) {
+    for (int i = x + 1; i <= nx_; i += i & -i) {
+      for (int j = y + 1; j <= ny_; j += j & -j) {
+        for (int k = z + 1; k <= nz_; k += k & -k) {
+          node(i, j, k) += delta;
+        }
+      }
+    }
+  }
+
+  // sum over [0..x] x [0..y] x [0..z], empty if any bound is negative
+  T prefix(int x, int y, int z) const {
+    T result{};
+    x = std::min(x, nx_ - 1);
+    y = std::min(y, ny_ - 1);
+    z = std::min(z, nz_ - 1);
+    for (int i = x + 1; i > 0; i -= i & -i) {
+      for (int j = y + 1; j > 0; j -= j & -j) {
+        for (int k = z + 1; k > 0; k -= k & -k) {
+          result += node(i, j, k);
+        }
+      }
+    }
+    return result;
+  }
+
+  // sum over the inclusive box [x1..x2] x [y1..y2] x [z1..z2]
+  T sum(int x1, int y1, int z1, int x2, int y2, int z2) const {
+    x1 = std::max(x1, 0);
+    y1 = std::max(y1, 0);
+    z1 = std::max(z1, 0);
+    if (x1 > x2 || y1 > y2 || z1 > z2) {
+      return T{};
+    }
+    --x1;
+    --y1;
+    --z1;
+    return prefix(x2, y2, z2) - prefix(x1, y2, z2) - prefix(x2, y1, z2) -
+           prefix(x2, y2, z1) + prefix(x1, y1, z2) + prefix(x1, y2, z1) +
+           prefix(x2, y1, z1) - prefix(x1, y1, z1);
+  }
+};
+} // namespace shipping
@@ -0,0 +1,138 @@
+// =====================================
+// Fleet - Assignment 4
+// many ships, sharded over worker threads, with fleet-wide group queries
+// =====================================
+#pragma once
+
+#include "Parallel.h"
+#include "Ship.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace shipping {
+template <typename Container> struct FleetEntry {
+  size_t ship;
+  Position3D position;
+  const Container *container;
+};
+
+// Ships are split round robin into shards and every fleet query runs one
+// task per shard, straight over each ship's own group index. A ship is only
+// touched by its shard's task, but fleet queries are not synchronized with
+// each other or with changes to the ships.
+template <typename Container> class Fleet {
+  std::vector<std::unique_ptr<Ship<Container>>> ships_;
+  std::vector<std::vector<size_t>> shards_;
+  mutable ThreadPool pool_;
+
+  template <typename Function> void for_each_shard(Function f) const {
+    TaskGroup group;
+    for (size_t shard = 0; shard < shards_.size(); ++shard) {
+      pool_.submit(group, [this, &f, shard] { f(shard, shards_[shard]); });
+    }
+    pool_.wait(group);
+  }
+
+public:
+  explicit Fleet(
+      size_t shards = std::max(1u, std::thread::hardware_concurrency()))
+      : shards_(std::max<size_t>(shards, 1)), pool_(shards_.size()) {}
+
+  // returns the id of the ship in this fleet
+  size_t addShip(Ship<Container> ship) {
+    size_t id = ships_.size();
+    ships_.push_back(std::make_unique<Ship<Container>>(std::move(ship)));
+    shards_[id % shards_.size()].push_back(id);
+    return id;
+  }
+  Ship<Container> &ship(size_t id) { return *ships_.at(id); }
+  const Ship<Container> &ship(size_t id) const { return *ships_.at(id); }
+  size_t size() const { return ships_.size(); }
+  size_t shards() const { return shards_.size(); }
+
+  // every container of the group on every ship, grouped by ship
+  std::vector<FleetEntry<Container>>
+  getContainersByGroup(const std::string &groupingName,
+                       const std::string &groupName) const {
+    using GroupView = decltype(std::declval<const Ship<Container> &>()
+                                   .getContainersViewByGroup(groupingName,
+                                                             groupName));
+    // the views taken to size the slices are the ones copied from
+    std::vector<GroupView> views(ships_.size(), GroupView{0});
+    std::vector<size_t> shard_sizes(shards_.size(), 0);
+    for_each_shard([&](size_t shard, const std::vector<size_t> &ids) {
+      for (auto id : ids) {
+        views[id] =
+            ships_[id]->getContainersViewByGroup(groupingName, groupName);
+        shard_sizes[shard] += views[id].size();
+      }
+    });
+    std::vector<size_t> offsets(shards_.size() + 1, 0);
+    for (size_t shard = 0; shard < shards_.size(); ++shard) {
+      offsets[shard + 1] = offsets[shard] + shard_sizes[shard];
+    }
+    // each shard copies straight into its own slice of the result
+    std::vector<FleetEntry<Container>> result(
+        offsets.back(),
+        FleetEntry<Container>{0, Position3D{X{0}, Y{0}, Height{0}}, nullptr});
+    for_each_shard([&](size_t shard, const std::vector<size_t> &ids) {
+      auto out = result.begin() + offsets[shard];
+      for (auto id : ids) {
+        for (const auto &entry : views[id]) {
+          *out++ = FleetEntry<Container>{id, entry.first, &entry.second};
+        }
+      }
+    });
+    return result;
+  }
+
+  size_t countByGroup(const std::string &groupingName,
+                      const std::string &groupName) const {
+    return reduceByShip(
+        size_t{0},
+        [&](const Ship<Container> &ship) {
+          return ship.getContainersViewByGroup(groupingName, groupName).size();
+        },
+        [](size_t a, size_t b) { return a + b; });
+  }
+
+  // map(position, container) over the group on every ship, folded with an
+  // associative reduce; init is combined in exactly once
+  template <typename T, typename Map, typename Reduce>
+  T reduceByGroup(const std::string &groupingName,
+                  const std::string &groupName, T init, Map map,
+                  Reduce reduce) const {
+    std::vector<std::optional<T>> partials(shards_.size());
+    for_each_shard([&](size_t shard, const std::vector<size_t> &ids) {
+      auto &partial = partials[shard];
+      for (auto id : ids) {
+        for (auto entry :
+             ships_[id]->getContainersViewByGroup(groupingName, groupName)) {
+          detail::fold_partial<T>(partial, map(entry.first, entry.second),
+                                  reduce);
+        }
+      }
+    });
+    return detail::merge_partials(std::move(init), partials, reduce);
+  }
+
+  // map(ship) for every ship, folded the same way
+  template <typename T, typename Map, typename Reduce>
+  T reduceByShip(T init, Map map, Reduce reduce) const {
+    std::vector<std::optional<T>> partials(shards_.size());
+    for_each_shard([&](size_t shard, const std::vector<size_t> &ids) {
+      auto &partial = partials[shard];
+      for (auto id : ids) {
+        detail::fold_partial<T>(partial, map(*ships_[id]), reduce);
+      }
+    });
+    return detail::merge_partials(std::move(init), partials, reduce);
+  }
+};
+} // namespace shipping
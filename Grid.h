@@ -0,0 +1,241 @@
+// =====================================
+// Grid - Assignment 4
+// N-dimensional cell storage shared by ExamHall and Ship
+// =====================================
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace grid {
+template <std::size_t N> using Coordinates = std::array<int, N>;
+
+// Linear: first coordinate fastest, as in y * x_size + x.
+// Morton: Z-order inside square tiles of up to 16 cells a side, tiles in
+// linear order - cells that are close on the grid are close in memory,
+// while padding stays below one tile per dimension.
+enum class Layout { Linear, Morton };
+
+// injective 64 bit key of a coordinate tuple (64 / N bits per coordinate),
+// good as is for a hash
+template <std::size_t N>
+std::uint64_t packed_key(const Coordinates<N> &coordinates) {
+  constexpr int bits = 64 / N;
+  constexpr std::uint64_t mask =
+      bits == 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << bits) - 1;
+  std::uint64_t key = 0;
+  for (std::size_t d = 0; d < N; ++d) {
+    key = (key << (bits % 64)) |
+          (std::uint64_t(std::uint32_t(coordinates[d])) & mask);
+  }
+  return key;
+}
+
+namespace detail {
+// spreads the low bits of v apart, N - 1 zero bits after each
+template <std::size_t N> std::uint64_t spread_bits(std::uint64_t v) {
+  if constexpr (N == 1) {
+    return v;
+  } else if constexpr (N == 2) {
+    v &= 0xffffffff;
+    v = (v | (v << 16)) & 0x0000ffff0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0f;
+    v = (v | (v << 2)) & 0x3333333333333333;
+    return (v | (v << 1)) & 0x5555555555555555;
+  } else if constexpr (N == 3) {
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x001f00000000ffff;
+    v = (v | (v << 16)) & 0x001f0000ff0000ff;
+    v = (v | (v << 8)) & 0x100f00f00f00f00f;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3;
+    return (v | (v << 2)) & 0x1249249249249249;
+  } else {
+    std::uint64_t result = 0;
+    for (std::size_t bit = 0; bit * N < 64; ++bit) {
+      result |= ((v >> bit) & 1) << (bit * N);
+    }
+    return result;
+  }
+}
+} // namespace detail
+
+// maps coordinates to storage indices; a small value type, so views can
+// carry a copy instead of pointing back at the grid
+template <std::size_t N, Layout L> class Indexer {
+  Coordinates<N> extents_{};
+  Coordinates<N> tiles_{}; // tiles per dimension, Morton only
+  int tile_bits_ = 0;      // log2 of the tile side, Morton only
+  std::size_t size_ = 0;
+
+  static std::size_t linear(const Coordinates<N> &coordinates,
+                            const Coordinates<N> &extents) {
+    std::size_t index = 0;
+    for (std::size_t d = N; d-- > 0;) {
+      index = index * extents[d] + coordinates[d];
+    }
+    return index;
+  }
+
+public:
+  Indexer() = default;
+  explicit Indexer(const Coordinates<N> &extents) : extents_(extents) {
+    for (auto &extent : extents_) {
+      extent = std::max(extent, 0);
+    }
+    if constexpr (L == Layout::Linear) {
+      size_ = 1;
+      for (auto extent : extents_) {
+        size_ *= extent;
+      }
+    } else {
+      int smallest = *std::min_element(extents_.begin(), extents_.end());
+      while (tile_bits_ < 4 && (2 << tile_bits_) <= smallest) {
+        ++tile_bits_;
+      }
+      size_ = std::size_t{1} << (N * tile_bits_);
+      for (std::size_t d = 0; d < N; ++d) {
+        tiles_[d] = (extents_[d] + (1 << tile_bits_) - 1) >> tile_bits_;
+        size_ *= tiles_[d];
+      }
+    }
+  }
+
+  const Coordinates<N> &extents() const { return extents_; }
+  // storage cells, including Morton padding
+  std::size_t size() const { return size_; }
+
+  bool contains(const Coordinates<N> &coordinates) const {
+    for (std::size_t d = 0; d < N; ++d) {
+      if (coordinates[d] < 0 || coordinates[d] >= extents_[d]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // inverse of index, for indices of cells inside the grid
+  Coordinates<N> coordinates(std::size_t index) const {
+    Coordinates<N> result{};
+    if constexpr (L == Layout::Linear) {
+      for (std::size_t d = 0; d < N; ++d) {
+        result[d] = int(index % extents_[d]);
+        index /= extents_[d];
+      }
+    } else {
+      std::size_t in_tile = index & ((std::size_t{1} << (N * tile_bits_)) - 1);
+      index >>= N * tile_bits_;
+      for (std::size_t d = 0; d < N; ++d) {
+        result[d] = int(index % tiles_[d]) << tile_bits_;
+        index /= tiles_[d];
+        for (int bit = 0; bit < tile_bits_; ++bit) {
+          result[d] |= int((in_tile >> (bit * N + d)) & 1) << bit;
+        }
+      }
+    }
+    return result;
+  }
+
+  // no bounds check, see contains
+  std::size_t index(const Coordinates<N> &coordinates) const {
+    if constexpr (L == Layout::Linear) {
+      return linear(coordinates, extents_);
+    } else {
+      Coordinates<N> tile;
+      std::uint64_t in_tile = 0;
+      int tile_mask = (1 << tile_bits_) - 1;
+      for (std::size_t d = 0; d < N; ++d) {
+        tile[d] = coordinates[d] >> tile_bits_;
+        in_tile |= detail::spread_bits<N>(coordinates[d] & tile_mask) << d;
+      }
+      return (linear(tile, tiles_) << (N * tile_bits_)) | in_tile;
+    }
+  }
+};
+
+template <typename Item, std::size_t N, Layout L = Layout::Morton> class Grid {
+  Indexer<N, L> indexer_;
+  std::vector<Item> cells_;
+
+public:
+  Grid() = default;
+  explicit Grid(const Coordinates<N> &extents)
+      : indexer_(extents), cells_(indexer_.size()) {}
+
+  const Indexer<N, L> &indexer() const { return indexer_; }
+  const Coordinates<N> &extents() const { return indexer_.extents(); }
+  bool contains(const Coordinates<N> &coordinates) const {
+    return indexer_.contains(coordinates);
+  }
+  std::size_t index(const Coordinates<N> &coordinates) const {
+    return indexer_.index(coordinates);
+  }
+  Coordinates<N> coordinates(std::size_t index) const {
+    return indexer_.coordinates(index);
+  }
+
+  // by storage index
+  Item &operator[](std::size_t index) { return cells_[index]; }
+  const Item &operator[](std::size_t index) const { return cells_[index]; }
+  Item *data() { return cells_.data(); }
+  const Item *data() const { return cells_.data(); }
+  std::size_t size() const { return cells_.size(); }
+  auto begin() { return cells_.begin(); }
+  auto end() { return cells_.end(); }
+  auto begin() const { return cells_.begin(); }
+  auto end() const { return cells_.end(); }
+
+  // f(coordinates, item) for every cell of the inclusive box, clamped to
+  // the grid
+  template <typename Function>
+  void for_each_in_region(Coordinates<N> low, Coordinates<N> high,
+                          Function f) const {
+    for (std::size_t d = 0; d < N; ++d) {
+      low[d] = std::max(low[d], 0);
+      high[d] = std::min(high[d], extents()[d] - 1);
+      if (low[d] > high[d]) {
+        return;
+      }
+    }
+    Coordinates<N> at = low;
+    while (true) {
+      f(static_cast<const Coordinates<N> &>(at), cells_[index(at)]);
+      std::size_t d = 0;
+      while (d < N && at[d] == high[d]) {
+        at[d] = low[d];
+        ++d;
+      }
+      if (d == N) {
+        return;
+      }
+      ++at[d];
+    }
+  }
+
+  // f(coordinates, item) for every cell within Chebyshev distance radius of
+  // center, center excluded; orthogonal keeps only the cells that differ
+  // from center in a single coordinate (the 4-neighborhood in 2D)
+  template <typename Function>
+  void for_each_neighbor(const Coordinates<N> &center, int radius,
+                         bool orthogonal, Function f) const {
+    Coordinates<N> low = center;
+    Coordinates<N> high = center;
+    for (std::size_t d = 0; d < N; ++d) {
+      low[d] -= radius;
+      high[d] += radius;
+    }
+    auto visit = [&](const Coordinates<N> &at, const Item &item) {
+      std::size_t differing = 0;
+      for (std::size_t d = 0; d < N; ++d) {
+        differing += at[d] != center[d];
+      }
+      if (differing != 0 && (!orthogonal || differing == 1)) {
+        f(at, item);
+      }
+    };
+    for_each_in_region(low, high, visit);
+  }
+};
+} // namespace grid
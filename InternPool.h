@@ -0,0 +1,175 @@
+// =====================================
+// InternPool - Assignment 4
+// deduplicated, immutable container payloads behind 32 bit handles
+// =====================================
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+namespace shipping {
+// Every distinct payload is stored once, in an arena of chunks that double
+// in size and never move, and is named by its 32 bit handle from then on.
+// Interning locks; reading a payload by handle does not, so it is safe from
+// any thread that got the handle from an intern call that happened before.
+template <typename Payload> class InternPool {
+  static constexpr int first_chunk_bits = 6;
+  static constexpr int max_chunks = 32 - first_chunk_bits;
+
+  struct Hash {
+    size_t operator()(const std::reference_wrapper<const Payload> &p) const {
+      return std::hash<Payload>{}(p.get());
+    }
+  };
+  struct Equal {
+    bool operator()(const std::reference_wrapper<const Payload> &a,
+                    const std::reference_wrapper<const Payload> &b) const {
+      return a.get() == b.get();
+    }
+  };
+
+  Payload *chunks_[max_chunks] = {};
+  std::uint32_t size_ = 0;
+  // keys refer to the payloads in the arena
+  std::unordered_map<std::reference_wrapper<const Payload>, std::uint32_t,
+                     Hash, Equal>
+      index_;
+  std::mutex m_;
+
+  static int highest_bit(std::uint64_t v) {
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(v);
+#else
+    int bit = 0;
+    while (v >>= 1) {
+      ++bit;
+    }
+    return bit;
+#endif
+  }
+  // chunk k holds handles [2^(k+6) - 64, 2^(k+7) - 64)
+  static std::pair<int, std::uint64_t> locate(std::uint32_t handle) {
+    std::uint64_t v = std::uint64_t(handle) + (1u << first_chunk_bits);
+    int bit = highest_bit(v);
+    return {bit - first_chunk_bits, v - (std::uint64_t{1} << bit)};
+  }
+  static std::uint64_t chunk_capacity(int chunk) {
+    return std::uint64_t{1} << (chunk + first_chunk_bits);
+  }
+  // the chunks end at handle 2^32 - 64; locate() puts any later handle past
+  // the last chunk
+  static constexpr std::uint64_t max_size =
+      (std::uint64_t{1} << (max_chunks + first_chunk_bits)) -
+      (std::uint64_t{1} << first_chunk_bits);
+
+  template <typename T> std::uint32_t insert(T &&payload) {
+    if (size_ == max_size) {
+      throw std::length_error("intern pool full");
+    }
+    auto [chunk, offset] = locate(size_);
+    if (!chunks_[chunk]) {
+      chunks_[chunk] =
+          std::allocator<Payload>().allocate(chunk_capacity(chunk));
+    }
+    const Payload *stored =
+        new (chunks_[chunk] + offset) Payload(std::forward<T>(payload));
+    index_.emplace(std::cref(*stored), size_);
+    return size_++;
+  }
+
+public:
+  InternPool() = default;
+  ~InternPool() {
+    for (std::uint32_t handle = 0; handle < size_; ++handle) {
+      auto [chunk, offset] = locate(handle);
+      chunks_[chunk][offset].~Payload();
+    }
+    for (int chunk = 0; chunk < max_chunks && chunks_[chunk]; ++chunk) {
+      std::allocator<Payload>().deallocate(chunks_[chunk],
+                                           chunk_capacity(chunk));
+    }
+  }
+  InternPool(const InternPool &) = delete;
+  InternPool &operator=(const InternPool &) = delete;
+
+  // one pool per payload type, shared by every ship
+  static InternPool &global() {
+    static InternPool pool;
+    return pool;
+  }
+
+  // the handle of an equal payload, storing a copy first if there is none
+  std::uint32_t intern(const Payload &payload) {
+    std::lock_guard<std::mutex> lock(m_);
+    auto itr = index_.find(std::cref(payload));
+    return itr != index_.end() ? itr->second : insert(payload);
+  }
+  std::uint32_t intern(Payload &&payload) {
+    std::lock_guard<std::mutex> lock(m_);
+    auto itr = index_.find(std::cref(payload));
+    return itr != index_.end() ? itr->second : insert(std::move(payload));
+  }
+
+  const Payload &get(std::uint32_t handle) const {
+    auto [chunk, offset] = locate(handle);
+    return chunks_[chunk][offset];
+  }
+  std::uint32_t size() {
+    std::lock_guard<std::mutex> lock(m_);
+    return size_;
+  }
+};
+
+// A container that is a handle into the global pool of its payload type:
+// 4 bytes to copy or move, converts to const Payload & for grouping
+// functions. Payloads are immutable and live as long as the program.
+template <typename Payload> class Interned {
+  std::uint32_t handle_;
+
+public:
+  Interned(const Payload &payload)
+      : handle_(InternPool<Payload>::global().intern(payload)) {}
+  Interned(Payload &&payload)
+      : handle_(InternPool<Payload>::global().intern(std::move(payload))) {}
+  // anything a Payload can be built from, e.g. a string literal
+  template <typename T,
+            typename = std::enable_if_t<
+                std::is_constructible_v<Payload, T &&> &&
+                !std::is_same_v<std::decay_t<T>, Payload> &&
+                !std::is_same_v<std::decay_t<T>, Interned>>>
+  Interned(T &&value) : Interned(Payload(std::forward<T>(value))) {}
+
+  const Payload &get() const {
+    return InternPool<Payload>::global().get(handle_);
+  }
+  operator const Payload &() const { return get(); }
+  const Payload *operator->() const { return &get(); }
+  std::uint32_t handle() const { return handle_; }
+
+  bool operator==(const Interned &other) const {
+    return handle_ == other.handle_;
+  }
+  bool operator!=(const Interned &other) const {
+    return handle_ != other.handle_;
+  }
+};
+
+template <typename T> struct is_interned : std::false_type {};
+template <typename Payload>
+struct is_interned<Interned<Payload>> : std::true_type {};
+template <typename T> constexpr bool is_interned_v = is_interned<T>::value;
+} // namespace shipping
+
+namespace std {
+template <typename Payload> struct hash<shipping::Interned<Payload>> {
+  std::size_t operator()(const shipping::Interned<Payload> &p) const noexcept {
+    return p.handle();
+  }
+};
+} // namespace std
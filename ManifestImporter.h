@@ -0,0 +1,308 @@
+// =====================================
+// ManifestImporter - Assignment 4
+// bulk loading of a ship from a delimited manifest file
+// =====================================
+#pragma once
+
+#include "Ship.h"
+#include "ThreadPool.h"
+
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SHIPPING_MANIFEST_MMAP 1
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace shipping {
+namespace manifest_detail {
+// first c in [first, last), or last; 16 bytes per compare where SSE2 is there
+inline const char *find_byte(const char *first, const char *last, char c) {
+#if defined(__SSE2__)
+  const __m128i needle = _mm_set1_epi8(c);
+  for (; last - first >= 16; first += 16) {
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(first)), needle));
+    if (mask != 0) {
+      return first + __builtin_ctz(mask);
+    }
+  }
+#endif
+  auto found = static_cast<const char *>(std::memchr(first, c, last - first));
+  return found ? found : last;
+}
+} // namespace manifest_detail
+
+// the whole file, read only - mapped where the platform allows, read
+// otherwise
+class MappedFile {
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+#ifndef SHIPPING_MANIFEST_MMAP
+  std::string contents_;
+#endif
+
+public:
+  explicit MappedFile(const std::string &path) {
+#ifdef SHIPPING_MANIFEST_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || ::fstat(fd, &info) != 0) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      throw std::runtime_error(path + ": cannot open manifest");
+    }
+    size_ = size_t(info.st_size);
+    if (size_ > 0) {
+      void *mapped = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error(path + ": cannot map manifest");
+      }
+      ::madvise(mapped, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char *>(mapped);
+    }
+    ::close(fd);
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      throw std::runtime_error(path + ": cannot open manifest");
+    }
+    contents_.assign(std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>());
+    data_ = contents_.data();
+    size_ = contents_.size();
+#endif
+  }
+  ~MappedFile() {
+#ifdef SHIPPING_MANIFEST_MMAP
+    if (data_) {
+      ::munmap(const_cast<char *>(data_), size_);
+    }
+#endif
+  }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  std::string_view view() const { return {data_, size_}; }
+};
+
+struct ManifestError {
+  // 1 based line of the manifest
+  size_t line;
+  std::string message;
+};
+
+struct ManifestReport {
+  size_t lines = 0;
+  size_t loaded = 0;
+  std::vector<ManifestError> errors;
+  std::chrono::nanoseconds wall_time{0};
+};
+
+// One container per line: x, y and then whatever fields makeContainer needs,
+// split at the delimiter. Blank lines and lines starting with '#' are
+// skipped. The text is cut into chunks at line ends; worker threads split
+// chunks into string_view fields and build the containers while the calling
+// thread loads the chunks already parsed, in file order. A bad line or a
+// rejected load is reported with its line number, the rest still go on
+// board. Anything else thrown while parsing is rethrown once the chunks
+// before it are loaded; anything else thrown while loading, once the
+// parsers have stopped.
+template <typename Container> class ManifestImporter {
+public:
+  // views into the manifest, valid only during the call
+  using Fields = std::vector<std::string_view>;
+  using MakeContainer = std::function<Container(const Fields &)>;
+
+private:
+  struct Chunk {
+    std::string_view text;
+    std::vector<std::tuple<X, Y, Container>> batch;
+    // by batch entry, chunk relative like all line numbers here
+    std::vector<size_t> batch_lines;
+    std::vector<ManifestError> errors;
+    size_t lines = 0;
+    std::exception_ptr failure;
+    bool ready = false;
+  };
+
+  // waits for the parse tasks when the import leaves, on any path, as they
+  // use its locals
+  struct ParsersGuard {
+    ThreadPool &pool;
+    TaskGroup &parsers;
+    ~ParsersGuard() {
+      try {
+        pool.wait(parsers);
+      } catch (...) {
+        // parse tasks keep their exceptions in their chunk
+      }
+    }
+  };
+
+  MakeContainer makeContainer_;
+  char delimiter_;
+  size_t chunk_bytes_;
+  mutable ThreadPool pool_;
+
+  static std::vector<Chunk> split(std::string_view text, size_t chunk_bytes) {
+    std::vector<Chunk> chunks;
+    const char *first = text.data();
+    const char *last = first + text.size();
+    while (first != last) {
+      const char *end = first + std::min<size_t>(chunk_bytes, last - first);
+      if (end != last) {
+        end = manifest_detail::find_byte(end - 1, last, '\n');
+        end = end == last ? last : end + 1;
+      }
+      chunks.emplace_back();
+      chunks.back().text = std::string_view(first, end - first);
+      first = end;
+    }
+    return chunks;
+  }
+
+  template <typename Int>
+  static bool parse_int(std::string_view field, Int &value) {
+    auto [end, error] =
+        std::from_chars(field.data(), field.data() + field.size(), value);
+    return error == std::errc{} && end == field.data() + field.size();
+  }
+
+  void parse(Chunk &chunk) const {
+    const char *first = chunk.text.data();
+    const char *last = first + chunk.text.size();
+    Fields fields;
+    for (; first != last; ++chunk.lines) {
+      const char *end = manifest_detail::find_byte(first, last, '\n');
+      std::string_view line(first, end - first);
+      first = end == last ? last : end + 1;
+      if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+      }
+      if (line.empty() || line.front() == '#') {
+        continue;
+      }
+      fields.clear();
+      const char *field = line.data();
+      const char *line_end = line.data() + line.size();
+      while (true) {
+        const char *next =
+            manifest_detail::find_byte(field, line_end, delimiter_);
+        fields.emplace_back(field, next - field);
+        if (next == line_end) {
+          break;
+        }
+        field = next + 1;
+      }
+      int x, y;
+      if (fields.size() < 2 || !parse_int(fields[0], x) ||
+          !parse_int(fields[1], y)) {
+        chunk.errors.push_back({chunk.lines, "bad x,y"});
+        continue;
+      }
+      try {
+        chunk.batch.emplace_back(X{x}, Y{y}, makeContainer_(fields));
+        chunk.batch_lines.push_back(chunk.lines);
+      } catch (const std::exception &e) {
+        chunk.errors.push_back({chunk.lines, e.what()});
+      }
+    }
+  }
+
+public:
+  explicit ManifestImporter(
+      MakeContainer makeContainer, char delimiter = ',',
+      size_t parsers = std::max(1u, std::thread::hardware_concurrency()),
+      size_t chunk_bytes = size_t{1} << 20)
+      : makeContainer_(std::move(makeContainer)), delimiter_(delimiter),
+        chunk_bytes_(std::max<size_t>(chunk_bytes, 1)), pool_(parsers) {}
+
+  ManifestReport importFile(Ship<Container> &ship,
+                            const std::string &path) const {
+    MappedFile file(path);
+    return import(ship, file.view());
+  }
+
+  ManifestReport import(Ship<Container> &ship, std::string_view text) const {
+    auto started = std::chrono::steady_clock::now();
+    ManifestReport report;
+    auto chunks = split(text, chunk_bytes_);
+    // chunks in flight, bounds the memory held by parsed containers
+    size_t window = pool_.size() * 2;
+    std::mutex ready_m;
+    std::condition_variable ready_cv;
+    TaskGroup parsers;
+    ParsersGuard guard{pool_, parsers};
+    auto submit = [&](size_t i) {
+      pool_.submit(parsers, [this, &chunks, &ready_m, &ready_cv, i] {
+        auto &chunk = chunks[i];
+        try {
+          parse(chunk);
+        } catch (...) {
+          chunk.failure = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(ready_m);
+        chunk.ready = true;
+        ready_cv.notify_all();
+      });
+    };
+    for (size_t i = 0; i < std::min(window, chunks.size()); ++i) {
+      submit(i);
+    }
+    for (size_t i = 0; i < chunks.size(); ++i) {
+      auto &chunk = chunks[i];
+      {
+        std::unique_lock<std::mutex> lock(ready_m);
+        ready_cv.wait(lock, [&chunk] { return chunk.ready; });
+      }
+      if (chunk.failure) {
+        // no more chunks are submitted; guard waits for those in flight
+        std::rethrow_exception(chunk.failure);
+      }
+      if (i + window < chunks.size()) {
+        submit(i + window);
+      }
+      size_t first_line = report.lines;
+      for (auto &error : chunk.errors) {
+        report.errors.push_back(
+            {first_line + error.line + 1, std::move(error.message)});
+      }
+      auto rejected = [&](size_t entry, const BadShipOperationException &e) {
+        report.errors.push_back(
+            {first_line + chunk.batch_lines[entry] + 1, e.message()});
+      };
+      report.loaded += ship.loadBatch(chunk.batch, rejected);
+      report.lines += chunk.lines;
+      chunk.batch = {};
+      chunk.batch_lines = {};
+    }
+    // errors of a chunk come in two runs, parse then load
+    std::stable_sort(report.errors.begin(), report.errors.end(),
+                     [](const ManifestError &a, const ManifestError &b) {
+                       return a.line < b.line;
+                     });
+    report.wall_time = std::chrono::steady_clock::now() - started;
+    return report;
+  }
+};
+} // namespace shipping
@@ -0,0 +1,76 @@
+// =====================================
+// Parallel - Assignment 4
+// chunked parallel scans over Ship and its group views
+// =====================================
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <optional>
+#include <vector>
+
+namespace shipping {
+inline ThreadPool &default_thread_pool() {
+  static ThreadPool pool;
+  return pool;
+}
+
+namespace detail {
+// partial results of parallel folds, one per chunk (or shard), empty until
+// the chunk's first item: init is then combined in once, by merge_partials
+template <typename T, typename Reduce>
+void fold_partial(std::optional<T> &partial, T value, Reduce &reduce) {
+  if (partial) {
+    partial = reduce(std::move(*partial), std::move(value));
+  } else {
+    partial = std::move(value);
+  }
+}
+template <typename T, typename Reduce>
+T merge_partials(T init, std::vector<std::optional<T>> &partials,
+                 Reduce &reduce) {
+  for (auto &partial : partials) {
+    if (partial) {
+      init = reduce(std::move(init), std::move(*partial));
+    }
+  }
+  return init;
+}
+} // namespace detail
+
+// Range is anything with split(n) returning iterable chunks - Ship (a chunk
+// per slice of columns) or a group view (a chunk per slice of its members).
+// A few chunks per worker leave room for stealing when chunks are uneven.
+template <typename Range, typename Function>
+void parallel_for_each(const Range &range, Function f,
+                       ThreadPool &pool = default_thread_pool()) {
+  auto chunks = range.split(pool.size() * 4);
+  TaskGroup group;
+  for (const auto &chunk : chunks) {
+    pool.submit(group, [&chunk, &f] {
+      for (auto &&item : chunk) {
+        f(item);
+      }
+    });
+  }
+  pool.wait(group);
+}
+
+// reduce must be associative; init is combined in exactly once
+template <typename Range, typename T, typename Map, typename Reduce>
+T parallel_reduce(const Range &range, T init, Map map, Reduce reduce,
+                  ThreadPool &pool = default_thread_pool()) {
+  auto chunks = range.split(pool.size() * 4);
+  std::vector<std::optional<T>> partials(chunks.size());
+  TaskGroup group;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    pool.submit(group, [&chunks, &partials, &map, &reduce, i] {
+      for (auto &&item : chunks[i]) {
+        detail::fold_partial<T>(partials[i], map(item), reduce);
+      }
+    });
+  }
+  pool.wait(group);
+  return detail::merge_partials(std::move(init), partials, reduce);
+}
+} // namespace shipping
@@ -2,14 +2,27 @@
 // Ship - Assignment 4
 // Sukesh Cheripalli, Puneet Udupi
 // =====================================
+#pragma once
+
+#include "DeltaStream.h"
+#include "Fenwick.h"
+#include "Grid.h"
+#include "InternPool.h"
+#include "ShipTrace.h"
+#include "SortedRuns.h"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <iostream>
-#include <list>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <tuple>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 namespace shipping {
@@ -41,12 +54,13 @@ using Position3D = std::tuple<shipping::X, shipping::Y, shipping::Height>;
 namespace std {
 template <> struct hash<shipping::Position> {
   std::size_t operator()(const shipping::Position &pos) const noexcept {
-    return std::get<0>(pos) ^ (std::get<1>(pos) << 1);
+    return grid::packed_key<2>({std::get<0>(pos), std::get<1>(pos)});
   }
 };
 template <> struct hash<shipping::Position3D> {
   std::size_t operator()(const shipping::Position3D &pos) const noexcept {
-    return std::get<0>(pos) ^ (std::get<1>(pos) << 1) ^ (std::get<2>(pos) << 2);
+    return grid::packed_key<3>(
+        {std::get<0>(pos), std::get<1>(pos), std::get<2>(pos)});
   }
 };
 
@@ -62,6 +76,7 @@ class BadShipOperationException {
 public:
   BadShipOperationException(std::string msg) : msg(std::move(msg)) {}
   void print() const { std::cout << msg << std::endl; }
+  const std::string &message() const { return msg; }
 };
 
 template <typename Container>
@@ -69,158 +84,799 @@ using Grouping =
     std::unordered_map<std::string,
                        std::function<std::string(const Container &)>>;
 
+// numeric per-container quantities (e.g. weight) summed by region queries
+template <typename Container>
+using Measures =
+    std::unordered_map<std::string,
+                       std::function<long long(const Container &)>>;
+
+// height of a container in sub-units of the ship's height (e.g. half feet,
+// so 8'6" and 9'6" boxes are 17 and 19), at least 1
+template <typename Container>
+using ContainerHeight = std::function<int(const Container &)>;
+
+// containers of groupA may not be within `distance` columns (in x and in y)
+// of containers of groupB, both groups of the same grouping; distance 0
+// forbids sharing a column. groupA == groupB keeps a group apart from itself.
+struct SegregationConstraint {
+  std::string groupingName;
+  std::string groupA;
+  std::string groupB;
+  int distance;
+};
+
+template <typename Container> class CraneScheduler;
+
 template <typename Container> class Ship {
+  friend class CraneScheduler<Container>;
+  // one x,y stack of the ship, shared copy-on-write between forks
+  // slots grow with the stack: with container heights, max_height is in
+  // sub-units and says little about how many containers a column holds.
+  // A deque, so growing never moves the containers already on board and
+  // references handed out by views stay valid across loads.
+  struct Column {
+    std::deque<std::optional<Container>> slots;
+    size_t size = 0;
+    // sum of the container heights, in sub-units
+    int height = 0;
+  };
+  using ColumnPtr = std::shared_ptr<Column>;
+  using ColumnIndexer = grid::Indexer<2, grid::Layout::Morton>;
+
+  // group members are kept as positions, which stay valid when the ship is
+  // copied, and resolved to containers through the columns when viewed.
+  // Dense, so that group views split into random access chunks.
+  struct GroupMembers {
+    std::vector<Position3D> positions;
+    std::unordered_map<Position3D, size_t> index;
+    void insert(const Position3D &pos) {
+      if (index.insert({pos, positions.size()}).second) {
+        positions.push_back(pos);
+      }
+    }
+    void erase(const Position3D &pos) {
+      auto itr = index.find(pos);
+      if (itr == index.end()) {
+        return;
+      }
+      size_t i = itr->second;
+      index.erase(itr);
+      if (i + 1 != positions.size()) {
+        positions[i] = positions.back();
+        index[positions[i]] = i;
+      }
+      positions.pop_back();
+    }
+  };
+  // entry of an ordered group: by key (a measure, or 0 when ordered by
+  // position), then by position
+  struct OrderedEntry {
+    long long key;
+    Position3D position;
+    bool operator<(const OrderedEntry &other) const {
+      return std::tie(key, position) < std::tie(other.key, other.position);
+    }
+  };
+  using OrderedMembers = SortedRuns<OrderedEntry>;
+  struct GroupSlot {
+    std::shared_ptr<GroupMembers> members = std::make_shared<GroupMembers>();
+    // only in groupings ordered by orderGroupsBy, null until first used
+    std::shared_ptr<OrderedMembers> ordered;
+    // created by the first subscriber, never shared with a fork
+    std::shared_ptr<DeltaStream> stream;
+  };
+
+  template <typename T> struct ArrowProxy {
+    T value;
+    const T *operator->() const { return &value; }
+  };
+
+  // Group and region views hand out their entries by value: a pair of the
+  // position and a reference to the container, built on dereference. Bind
+  // them with const auto & or auto &&, not auto & as with the
+  // unordered_map<Position3D, const Container &> views they replace.
+  using ViewEntry = std::pair<const Position3D, const Container &>;
+
+  static const Container &container_at(const ColumnPtr *columns,
+                                       const ColumnIndexer &indexer,
+                                       const Position3D &pos) {
+    return columns[indexer.index({std::get<0>(pos), std::get<1>(pos)})]
+        ->slots[std::get<2>(pos)]
+        .value();
+  }
+
+  // random access over the member positions, which are contiguous, so
+  // group views work with parallel algorithms (std::execution::par) as well
+  // as with split()
+  class GroupViewIterator {
+    const Position3D *members_itr_ = nullptr;
+    const ColumnPtr *columns_ = nullptr;
+    ColumnIndexer indexer_;
+
+  public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = ViewEntry;
+    using difference_type = std::ptrdiff_t;
+    using pointer = ArrowProxy<value_type>;
+    using reference = value_type;
+
+    GroupViewIterator() {}
+    GroupViewIterator(const Position3D *members_itr, const ColumnPtr *columns,
+                      const ColumnIndexer &indexer)
+        : members_itr_(members_itr), columns_(columns), indexer_(indexer) {}
+    GroupViewIterator &operator++() {
+      ++members_itr_;
+      return *this;
+    }
+    GroupViewIterator operator++(int) {
+      GroupViewIterator temp_obj = *this;
+      ++members_itr_;
+      return temp_obj;
+    }
+    GroupViewIterator &operator--() {
+      --members_itr_;
+      return *this;
+    }
+    GroupViewIterator operator--(int) {
+      GroupViewIterator temp_obj = *this;
+      --members_itr_;
+      return temp_obj;
+    }
+    GroupViewIterator &operator+=(difference_type n) {
+      members_itr_ += n;
+      return *this;
+    }
+    GroupViewIterator &operator-=(difference_type n) {
+      members_itr_ -= n;
+      return *this;
+    }
+    GroupViewIterator operator+(difference_type n) const {
+      GroupViewIterator temp_obj = *this;
+      return temp_obj += n;
+    }
+    friend GroupViewIterator operator+(difference_type n,
+                                       const GroupViewIterator &itr) {
+      return itr + n;
+    }
+    GroupViewIterator operator-(difference_type n) const {
+      GroupViewIterator temp_obj = *this;
+      return temp_obj -= n;
+    }
+    difference_type operator-(const GroupViewIterator &other) const {
+      return members_itr_ - other.members_itr_;
+    }
+    value_type operator*() const {
+      return {*members_itr_, container_at(columns_, indexer_, *members_itr_)};
+    }
+    value_type operator[](difference_type n) const { return *(*this + n); }
+    pointer operator->() const { return {**this}; }
+    bool operator==(const GroupViewIterator &other) const {
+      return members_itr_ == other.members_itr_;
+    }
+    bool operator!=(const GroupViewIterator &other) const {
+      return members_itr_ != other.members_itr_;
+    }
+    bool operator<(const GroupViewIterator &other) const {
+      return members_itr_ < other.members_itr_;
+    }
+    bool operator>(const GroupViewIterator &other) const {
+      return members_itr_ > other.members_itr_;
+    }
+    bool operator<=(const GroupViewIterator &other) const {
+      return members_itr_ <= other.members_itr_;
+    }
+    bool operator>=(const GroupViewIterator &other) const {
+      return members_itr_ >= other.members_itr_;
+    }
+  };
+
+  template <typename Iterator> class RangeView {
+    Iterator begin_;
+    Iterator end_;
+
+  public:
+    RangeView(Iterator begin, Iterator end) : begin_(begin), end_(end) {}
+    RangeView(int) {}
+    Iterator begin() const { return begin_; }
+    Iterator end() const { return end_; }
+  };
+
   class GroupView {
-    const std::unordered_map<Position3D, const Container &> *p_group = nullptr;
-    using IteratorType =
-        typename std::unordered_map<Position3D,
-                                    const Container &>::const_iterator;
+    const GroupSlot *p_group = nullptr;
+    const ColumnPtr *columns_ = nullptr;
+    ColumnIndexer indexer_;
+
+    GroupViewIterator at(size_t i) const {
+      return GroupViewIterator{p_group->members->positions.data() + i,
+                               columns_, indexer_};
+    }
 
   public:
-    GroupView(const std::unordered_map<Position3D, const Container &> &group)
-        : p_group(&group) {}
+    GroupView(const GroupSlot &group, const ColumnPtr *columns,
+              const ColumnIndexer &indexer)
+        : p_group(&group), columns_(columns), indexer_(indexer) {}
     GroupView(int) {}
-    auto begin() const { return p_group ? p_group->begin() : IteratorType{}; }
-    auto end() const { return p_group ? p_group->end() : IteratorType{}; }
+    GroupViewIterator begin() const {
+      return p_group ? at(0) : GroupViewIterator{};
+    }
+    GroupViewIterator end() const {
+      return p_group ? at(size()) : GroupViewIterator{};
+    }
+    size_t size() const {
+      return p_group ? p_group->members->positions.size() : 0;
+    }
+    // up to n chunks of near equal size, valid until the group next changes
+    std::vector<RangeView<GroupViewIterator>> split(size_t n) const {
+      std::vector<RangeView<GroupViewIterator>> chunks;
+      size_t total = size();
+      n = std::max<size_t>(1, std::min(n, total));
+      for (size_t i = 0; i < n && total > 0; ++i) {
+        chunks.emplace_back(at(total * i / n), at(total * (i + 1) / n));
+      }
+      return chunks;
+    }
+  };
+
+  class OrderedGroupIterator {
+    typename OrderedMembers::const_iterator itr_;
+    const ColumnPtr *columns_ = nullptr;
+    ColumnIndexer indexer_;
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = std::pair<Position3D, const Container &>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = ArrowProxy<value_type>;
+    using reference = value_type;
+
+    OrderedGroupIterator() {}
+    OrderedGroupIterator(typename OrderedMembers::const_iterator itr,
+                         const ColumnPtr *columns, const ColumnIndexer &indexer)
+        : itr_(itr), columns_(columns), indexer_(indexer) {}
+    OrderedGroupIterator &operator++() {
+      ++itr_;
+      return *this;
+    }
+    OrderedGroupIterator operator++(int) {
+      OrderedGroupIterator temp_obj = *this;
+      ++itr_;
+      return temp_obj;
+    }
+    OrderedGroupIterator &operator--() {
+      --itr_;
+      return *this;
+    }
+    OrderedGroupIterator operator--(int) {
+      OrderedGroupIterator temp_obj = *this;
+      --itr_;
+      return temp_obj;
+    }
+    value_type operator*() const {
+      return {itr_->position, container_at(columns_, indexer_, itr_->position)};
+    }
+    pointer operator->() const { return {**this}; }
+    // the value the group is ordered by, 0 when ordered by position
+    long long key() const { return itr_->key; }
+    bool operator==(const OrderedGroupIterator &other) const {
+      return itr_ == other.itr_;
+    }
+    bool operator!=(const OrderedGroupIterator &other) const {
+      return itr_ != other.itr_;
+    }
+  };
+
+  // members in ascending order, valid until the group next changes
+  class OrderedGroupView {
+    const OrderedMembers *ordered_ = nullptr;
+    const ColumnPtr *columns_ = nullptr;
+    ColumnIndexer indexer_;
+    using MembersIterator = typename OrderedMembers::const_iterator;
+    MembersIterator begin_;
+    MembersIterator end_;
+
+    OrderedGroupView sub_view(MembersIterator begin,
+                              MembersIterator end) const {
+      OrderedGroupView view = *this;
+      view.begin_ = begin;
+      view.end_ = end;
+      return view;
+    }
+
+  public:
+    OrderedGroupView(const OrderedMembers &ordered, const ColumnPtr *columns,
+                     const ColumnIndexer &indexer)
+        : ordered_(&ordered), columns_(columns), indexer_(indexer),
+          begin_(ordered.begin()), end_(ordered.end()) {}
+    OrderedGroupView(int) {}
+    OrderedGroupIterator begin() const { return {begin_, columns_, indexer_}; }
+    OrderedGroupIterator end() const { return {end_, columns_, indexer_}; }
+    bool empty() const { return begin_ == end_; }
+
+    // members of the whole group with low <= key <= high, for groupings
+    // ordered by a measure
+    OrderedGroupView between(long long low, long long high) const {
+      if (!ordered_ || high < low) {
+        return sub_view(end_, end_);
+      }
+      Position3D first{X{INT_MIN}, Y{INT_MIN}, Height{INT_MIN}};
+      Position3D last{X{INT_MAX}, Y{INT_MAX}, Height{INT_MAX}};
+      return sub_view(ordered_->lower_bound({low, first}),
+                      ordered_->upper_bound({high, last}));
+    }
+    // members of the whole group from low to high in (x, y, z) order, for
+    // groupings ordered by position
+    OrderedGroupView between(const Position3D &low,
+                             const Position3D &high) const {
+      if (!ordered_ || high < low) {
+        return sub_view(end_, end_);
+      }
+      return sub_view(ordered_->lower_bound({0, low}),
+                      ordered_->upper_bound({0, high}));
+    }
+    // the k last members of this view, largest first; O(k)
+    RangeView<std::reverse_iterator<OrderedGroupIterator>>
+    topK(size_t k) const {
+      auto first = end_;
+      for (; k > 0 && first != begin_; --k) {
+        --first;
+      }
+      return {std::reverse_iterator<OrderedGroupIterator>(end()),
+              std::reverse_iterator<OrderedGroupIterator>(
+                  OrderedGroupIterator{first, columns_, indexer_})};
+    }
   };
 
   class GroupIterator {
-    using ContainersItr =
-        typename std::vector<std::optional<Container>>::const_iterator;
-    ContainersItr containers_itr;
-    ContainersItr containers_end;
+    const ColumnPtr *columns_itr;
+    const ColumnPtr *columns_end;
+    size_t slot = 0;
     void set_itr_to_occupied_load() {
-      while (containers_itr != containers_end && !(*containers_itr)) {
-        ++containers_itr;
+      while (columns_itr != columns_end &&
+             (!*columns_itr || slot >= (*columns_itr)->size)) {
+        ++columns_itr;
+        slot = 0;
       }
     }
 
   public:
-    GroupIterator(ContainersItr containers_itr, ContainersItr containers_end)
-        : containers_itr(containers_itr), containers_end(containers_end) {
+    GroupIterator(const ColumnPtr *columns_itr, const ColumnPtr *columns_end)
+        : columns_itr(columns_itr), columns_end(columns_end) {
       set_itr_to_occupied_load();
     }
     GroupIterator operator++() {
-      ++containers_itr;
+      ++slot;
       set_itr_to_occupied_load();
       return *this;
     }
-    const Container &operator*() const { return containers_itr->value(); }
+    const Container &operator*() const {
+      return (*columns_itr)->slots[slot].value();
+    }
     bool operator!=(GroupIterator other) const {
-      return containers_itr != other.containers_itr;
+      return columns_itr != other.columns_itr || slot != other.slot;
     }
   };
 
+  // walks one column from the top container down
   class PositionIterator {
-    using ContainersItr = typename std::list<
-        std::reference_wrapper<const Container>>::const_iterator;
-    ContainersItr containers_itr_;
+    const Column *column_ = nullptr;
+    int z_ = -1;
 
   public:
     PositionIterator(){};
-    PositionIterator(ContainersItr containers_itr)
-        : containers_itr_(containers_itr) {}
+    PositionIterator(const Column *column, int z) : column_(column), z_(z) {}
     PositionIterator operator++(int) {
       PositionIterator temp_obj = *this;
-      ++containers_itr_;
+      --z_;
       return temp_obj;
     }
     PositionIterator &operator++() {
-      ++containers_itr_;
+      --z_;
       return *this;
     }
-    const Container &operator*() const {
-      return (const Container &)(*containers_itr_);
-    }
-    bool operator!=(PositionIterator other) const {
-      return containers_itr_ != other.containers_itr_;
-    }
+    const Container &operator*() const { return column_->slots[z_].value(); }
+    bool operator!=(PositionIterator other) const { return z_ != other.z_; }
   };
 
   class PositionView {
-    std::list<std::reference_wrapper<const Container>> *pview_list_ = nullptr;
-    using IteratorType = typename std::list<
-        std::reference_wrapper<const Container>>::const_iterator;
+    const ColumnPtr *p_column_ = nullptr;
 
   public:
-    PositionView(std::list<std::reference_wrapper<const Container>> &pview_list)
-        : pview_list_(&pview_list) {}
+    PositionView(const ColumnPtr &column) : p_column_(&column) {}
     PositionView(int) {}
     auto begin() const {
-      return pview_list_ ? PositionIterator{pview_list_->begin()}
-                         : PositionIterator{};
+      return p_column_ && *p_column_
+                 ? PositionIterator{p_column_->get(),
+                                    (int)(*p_column_)->size - 1}
+                 : PositionIterator{};
     }
-    auto end() const {
-      return pview_list_ ? PositionIterator{pview_list_->end()}
-                         : PositionIterator{};
+    auto end() const { return PositionIterator{}; }
+  };
+
+  class RegionIterator {
+    const ColumnPtr *columns_ = nullptr;
+    ColumnIndexer indexer_;
+    int x1_ = 0, x2_ = -1, y2_ = -1, z1_ = 0, z2_ = -1;
+    int x_ = 0, y_ = 0, z_ = 0;
+    int top() const {
+      const auto &column = columns_[indexer_.index({x_, y_})];
+      return column ? std::min(z2_, (int)column->size - 1) : -1;
+    }
+    void set_itr_to_occupied_load() {
+      while (y_ <= y2_ && z_ > top()) {
+        if (++x_ > x2_) {
+          x_ = x1_;
+          ++y_;
+        }
+        z_ = z1_;
+      }
+    }
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = ViewEntry;
+    using difference_type = std::ptrdiff_t;
+    using pointer = ArrowProxy<value_type>;
+    using reference = value_type;
+
+    RegionIterator() {}
+    RegionIterator(const ColumnPtr *columns, const ColumnIndexer &indexer,
+                   int x1, int y1, int z1, int x2, int y2, int z2, bool end)
+        : columns_(columns), indexer_(indexer), x1_(x1), x2_(x2), y2_(y2),
+          z1_(z1), z2_(z2), x_(x1), y_(end ? y2 + 1 : y1), z_(z1) {
+      set_itr_to_occupied_load();
+    }
+    RegionIterator &operator++() {
+      ++z_;
+      set_itr_to_occupied_load();
+      return *this;
+    }
+    RegionIterator operator++(int) {
+      RegionIterator temp_obj = *this;
+      ++(*this);
+      return temp_obj;
+    }
+    value_type operator*() const {
+      return {Position3D{X{x_}, Y{y_}, Height{z_}},
+              columns_[indexer_.index({x_, y_})]->slots[z_].value()};
+    }
+    pointer operator->() const { return {**this}; }
+    bool operator==(const RegionIterator &other) const {
+      return x_ == other.x_ && y_ == other.y_ && z_ == other.z_;
+    }
+    bool operator!=(const RegionIterator &other) const {
+      return !(*this == other);
     }
   };
 
-  std::vector<std::optional<Container>> stacked_containers;
-  std::vector<size_t> stacked_compartment_sizes;
-  std::unordered_map<shipping::Position, int> restrictions_;
+  using RegionView = RangeView<RegionIterator>;
+
+  // occupied slots and per-measure sums, for O(log^3) box queries; z grows
+  // with the tallest stack, see addContainerToRegionIndex
+  struct RegionIndex {
+    FenwickTree3D<int> occupancy;
+    std::unordered_map<std::string, FenwickTree3D<long long>> measures;
+  };
+
   int x_size;
   int y_size;
   int h_size;
+  // columns by pos_index(x, y), null until first loaded
+  grid::Grid<ColumnPtr, 2> columns_;
+  std::unordered_map<shipping::Position, int> restrictions_;
 
   Grouping<Container> groupingFunctions_;
-  using Pos3D2Container = std::unordered_map<Position3D, const Container &>;
-  using Group = std::unordered_map<std::string, Pos3D2Container>;
+  using Group = std::unordered_map<std::string, GroupSlot>;
   // all groupings by their grouping name
   mutable std::unordered_map<std::string, Group> groups;
-  mutable std::vector<std::list<std::reference_wrapper<const Container>>>
-      position_list_;
-  //   private method
-  int pos_index(X x, Y y, Height z) const {
-    if (x >= 0 && x < x_size && y >= 0 && y < y_size && z >= 0 && z < h_size) {
-      return (z * x_size * y_size) + y * x_size + x;
+  Measures<Container> measureFunctions_;
+  // grouping name to the measure its groups are ordered by, "" for position
+  std::unordered_map<std::string, std::string> orderings_;
+  // null: every container is 1 high
+  ContainerHeight<Container> heightFunction_;
+  std::shared_ptr<RegionIndex> region_index_;
+  struct Segregation {
+    SegregationConstraint constraint;
+    // by pos_index(x, y): containers of groupA / groupB within distance
+    std::vector<int> near_a;
+    std::vector<int> near_b;
+  };
+  std::shared_ptr<std::vector<Segregation>> segregations_ =
+      std::make_shared<std::vector<Segregation>>();
+  // Interned containers only: group by grouping name and payload handle,
+  // filled as payloads are loaded, so it holds the payloads this ship has
+  // seen rather than every handle of the process wide pool; never shared
+  // with a fork
+  std::unordered_map<std::string,
+                     std::unordered_map<std::uint32_t, std::string>>
+      group_cache_;
+  // null unless startTrace, never shared with a fork
+  std::shared_ptr<TraceRecorder> trace_;
+  // by pos_index(x, y), empty until the first position subscription
+  mutable std::vector<std::shared_ptr<DeltaStream>> position_streams_;
+  // set by CraneScheduler while it runs operations on columns that do not
+  // interact on several threads: load and unload then hold it around
+  // everything but their own column (groups, indexes, streams, the group
+  // cache); null otherwise
+  std::mutex *shared_m_ = nullptr;
+
+  struct ForkTag {};
+  // shares every column, group and index with other until written
+  Ship(const Ship &other, ForkTag)
+      : x_size(other.x_size), y_size(other.y_size), h_size(other.h_size),
+        columns_(other.columns_), restrictions_(other.restrictions_),
+        groupingFunctions_(other.groupingFunctions_), groups(other.groups),
+        measureFunctions_(other.measureFunctions_),
+        orderings_(other.orderings_), heightFunction_(other.heightFunction_),
+        region_index_(other.region_index_),
+        segregations_(other.segregations_) {
+    for (auto &grouping : groups) {
+      for (auto &group : grouping.second) {
+        group.second.stream = nullptr;
+      }
     }
-    throw BadShipOperationException(
-        std::to_string(__LINE__) + " : " + std::to_string(x) + "," +
-        std::to_string(y) + "," + std::to_string(z) + ": index out of range");
   }
-  int pos_index(X x, Y y) const {
-    if (x >= 0 && x < x_size && y >= 0 && y < y_size) {
-      return y * x_size + x;
+
+  //   private method
+  size_t pos_index(X x, Y y) const {
+    if (columns_.contains({x, y})) {
+      return columns_.index({x, y});
     }
     throw BadShipOperationException(std::to_string(__LINE__) + " : " +
                                     std::to_string(x) + "," +
                                     std::to_string(y) + ": index out of range");
   }
-  Container &get_container(X x, Y y) {
-    return stacked_containers
-        [pos_index(x, y,
-                   (Height)(stacked_compartment_sizes[pos_index(x, y)] - 1))]
-            .value();
+  size_t column_size(X x, Y y) const {
+    const auto &column = columns_[pos_index(x, y)];
+    return column ? column->size : 0;
+  }
+  int container_height(const Container &c) const {
+    return heightFunction_ ? heightFunction_(c) : 1;
+  }
+  std::unique_lock<std::mutex> lock_shared() {
+    return shared_m_ ? std::unique_lock<std::mutex>(*shared_m_)
+                     : std::unique_lock<std::mutex>();
   }
-  Container &get_container(X x, Y y, Height z) {
-    return stacked_containers[pos_index(x, y, z)].value();
+  // copy-on-write: clones the column if a fork still shares it
+  Column &mutable_column(X x, Y y) {
+    auto &column = columns_[pos_index(x, y)];
+    if (!column) {
+      column = std::make_shared<Column>();
+    } else if (column.use_count() > 1) {
+      column = std::make_shared<Column>(*column);
+    }
+    return *column;
+  }
+  GroupMembers &mutable_members(GroupSlot &group) {
+    if (group.members.use_count() > 1) {
+      group.members = std::make_shared<GroupMembers>(*group.members);
+    }
+    return *group.members;
+  }
+  OrderedMembers &mutable_ordered(GroupSlot &group) {
+    if (!group.ordered) {
+      group.ordered = std::make_shared<OrderedMembers>();
+    } else if (group.ordered.use_count() > 1) {
+      group.ordered = std::make_shared<OrderedMembers>(*group.ordered);
+    }
+    return *group.ordered;
+  }
+  OrderedEntry ordered_entry(const std::string &measureName,
+                             const Container &c, const Position3D &pos) const {
+    return {measureName.empty() ? 0 : measureFunctions_.at(measureName)(c),
+            pos};
+  }
+  RegionIndex &mutable_region_index() {
+    if (region_index_.use_count() > 1) {
+      region_index_ = std::make_shared<RegionIndex>(*region_index_);
+    }
+    return *region_index_;
+  }
+  std::vector<Segregation> &mutable_segregations() {
+    if (segregations_.use_count() > 1) {
+      segregations_ =
+          std::make_shared<std::vector<Segregation>>(*segregations_);
+    }
+    return *segregations_;
+  }
+  // gives this ship its own copy of everything still shared with a fork
+  void unshare() {
+    for (auto &column : columns_) {
+      if (column) {
+        column = std::make_shared<Column>(*column);
+      }
+    }
+    for (auto &grouping : groups) {
+      for (auto &group : grouping.second) {
+        group.second.members =
+            std::make_shared<GroupMembers>(*group.second.members);
+        if (group.second.ordered) {
+          group.second.ordered =
+              std::make_shared<OrderedMembers>(*group.second.ordered);
+        }
+      }
+    }
+    region_index_ = std::make_shared<RegionIndex>(*region_index_);
+    segregations_ = std::make_shared<std::vector<Segregation>>(*segregations_);
+  }
+  const Container &get_container(X x, Y y, Height z) const {
+    return columns_[pos_index(x, y)]->slots[z].value();
+  }
+  // group of c in a grouping; an interned payload's groups are computed
+  // once, when it is first loaded, and read from the cache after that.
+  // scratch holds the result otherwise.
+  const std::string &group_of(const std::string &groupingName,
+                              const std::function<std::string(
+                                  const Container &)> &groupingFunction,
+                              const Container &c, std::string &scratch) {
+    if constexpr (is_interned_v<Container>) {
+      auto &cache = group_cache_[groupingName];
+      auto itr = cache.find(c.handle());
+      if (itr == cache.end()) {
+        itr = cache.emplace(c.handle(), groupingFunction(c)).first;
+      }
+      return itr->second;
+    } else {
+      scratch = groupingFunction(c);
+      return scratch;
+    }
   }
   void addContainerToGroups(X x, Y y, Height z) {
-    Container &e = get_container(x, y, z);
-    // std::cout << groupingFunctions_.size() << std::endl;
+    const Container &e = get_container(x, y, z);
     for (auto &group_pair : groupingFunctions_) {
-      groups[group_pair.first][group_pair.second(e)].insert(
-          {std::tuple{x, y, z}, e});
+      std::string scratch;
+      const auto &group_name =
+          group_of(group_pair.first, group_pair.second, e, scratch);
+      auto &group = groups[group_pair.first][group_name];
+      mutable_members(group).insert(std::tuple{x, y, z});
+      updateOrdered(group_pair.first, group, e, std::tuple{x, y, z}, true);
+      updateSegregations(group_pair.first, group_name, x, y, 1);
+      if (group.stream) {
+        group.stream->publish(DeltaKind::Insert, x, y, z);
+      }
     }
   }
   void removeContainerFromGroups(X x, Y y, Height z) {
-    Container &e = get_container(x, y, z);
+    const Container &e = get_container(x, y, z);
     for (auto &group_pair : groupingFunctions_) {
-      groups[group_pair.first][group_pair.second(e)].erase(std::tuple{x, y, z});
+      std::string scratch;
+      const auto &group_name =
+          group_of(group_pair.first, group_pair.second, e, scratch);
+      auto &group = groups[group_pair.first][group_name];
+      mutable_members(group).erase(std::tuple{x, y, z});
+      updateOrdered(group_pair.first, group, e, std::tuple{x, y, z}, false);
+      updateSegregations(group_pair.first, group_name, x, y, -1);
+      if (group.stream) {
+        group.stream->publish(DeltaKind::Remove, x, y, z);
+      }
     }
   }
 
-  void addContainerToPList(X x, Y y, Height z) {
-    Container &c = get_container(x, y, z);
-    position_list_[pos_index(x, y)].push_front(c);
-    // for (auto &test : position_list_[pos_index(x, y)])
-    //   std::cout << (std::string)test << " ";
-    // std::cout << std::endl;
+  void updateOrdered(const std::string &groupingName, GroupSlot &group,
+                     const Container &e, const Position3D &pos, bool insert) {
+    if (orderings_.empty()) {
+      return;
+    }
+    auto itr = orderings_.find(groupingName);
+    if (itr == orderings_.end()) {
+      return;
+    }
+    auto entry = ordered_entry(itr->second, e, pos);
+    if (insert) {
+      mutable_ordered(group).insert(entry);
+    } else {
+      mutable_ordered(group).erase(entry);
+    }
   }
 
-  void removeContainerFromPList(X x, Y y, Height z) {
-    position_list_[pos_index(x, y)].pop_front();
+  void spreadSegregation(const Segregation &segregation,
+                         std::vector<int> &near, X x, Y y, int delta) const {
+    int d = segregation.constraint.distance;
+    columns_.for_each_in_region({x - d, y - d}, {x + d, y + d},
+                                [&](const grid::Coordinates<2> &at, auto &) {
+                                  near[columns_.index(at)] += delta;
+                                });
+  }
+  void updateSegregations(const std::string &groupingName,
+                          const std::string &groupName, X x, Y y, int delta) {
+    if (segregations_->empty()) {
+      return;
+    }
+    for (auto &segregation : mutable_segregations()) {
+      const auto &constraint = segregation.constraint;
+      if (constraint.groupingName != groupingName) {
+        continue;
+      }
+      if (constraint.groupA == groupName) {
+        spreadSegregation(segregation, segregation.near_a, x, y, delta);
+      }
+      if (constraint.groupB == groupName) {
+        spreadSegregation(segregation, segregation.near_b, x, y, delta);
+      }
+    }
+  }
+  // O(1) per constraint: the counters already hold the neighborhood
+  void checkSegregations(X x, Y y, const Container &c) {
+    size_t index = pos_index(x, y);
+    for (const auto &segregation : *segregations_) {
+      const auto &constraint = segregation.constraint;
+      std::string scratch;
+      const auto &group_name =
+          group_of(constraint.groupingName,
+                   groupingFunctions_.at(constraint.groupingName), c, scratch);
+      if ((group_name == constraint.groupA && segregation.near_b[index] > 0) ||
+          (group_name == constraint.groupB && segregation.near_a[index] > 0)) {
+        throw BadShipOperationException(
+            std::to_string(__LINE__) + " : " + std::to_string(x) + "," +
+            std::to_string(y) + ": segregation of " + constraint.groupA +
+            " and " + constraint.groupB + " within " +
+            std::to_string(constraint.distance));
+      }
+    }
+  }
+
+  // operands of a Load record of c at (x, y), groups and measures in the
+  // order of the trace header
+  void trace_load(TraceRecord &record, X x, Y y, const Container &c) {
+    record.x = x;
+    record.y = y;
+    record.height = container_height(c);
+    for (const auto &group_pair : groupingFunctions_) {
+      std::string scratch;
+      record.groups.push_back(
+          group_of(group_pair.first, group_pair.second, c, scratch));
+    }
+    for (const auto &measure_pair : measureFunctions_) {
+      record.measures.push_back(measure_pair.second(c));
+    }
+  }
+
+  void publishPositionDelta(DeltaKind kind, X x, Y y, Height z) {
+    if (!position_streams_.empty()) {
+      if (auto &stream = position_streams_[pos_index(x, y)]) {
+        stream->publish(kind, x, y, z);
+      }
+    }
+  }
+
+  void addContainerToRegionIndex(X x, Y y, Height z) {
+    const Container &c = get_container(x, y, z);
+    auto &region_index = mutable_region_index();
+    int z_size = region_index.occupancy.z_size();
+    if (z >= z_size) {
+      // doubling keeps the growth O(1) amortized per container
+      z_size = std::min(std::max(z + 1, 2 * z_size), h_size);
+      region_index.occupancy.grow_z(z_size);
+      for (auto &measure_pair : region_index.measures) {
+        measure_pair.second.grow_z(z_size);
+      }
+    }
+    region_index.occupancy.add(x, y, z, 1);
+    for (auto &measure_pair : measureFunctions_) {
+      region_index.measures[measure_pair.first].add(x, y, z,
+                                                    measure_pair.second(c));
+    }
+  }
+
+  void removeContainerFromRegionIndex(X x, Y y, Height z) {
+    const Container &c = get_container(x, y, z);
+    auto &region_index = mutable_region_index();
+    region_index.occupancy.add(x, y, z, -1);
+    for (auto &measure_pair : measureFunctions_) {
+      region_index.measures[measure_pair.first].add(x, y, z,
+                                                    -measure_pair.second(c));
+    }
+  }
+
+  // clamps an inclusive box to the ship, false if nothing is left of it
+  bool clamp_region(int &x1, int &y1, int &z1, int &x2, int &y2,
+                    int &z2) const {
+    x1 = std::max(x1, 0);
+    y1 = std::max(y1, 0);
+    z1 = std::max(z1, 0);
+    x2 = std::min(x2, x_size - 1);
+    y2 = std::min(y2, y_size - 1);
+    z2 = std::min(z2, h_size - 1);
+    return x1 <= x2 && y1 <= y2 && z1 <= z2;
   }
 
 public:
@@ -228,13 +884,9 @@ public:
   // TODO: (4) implement restrictions
 
   Ship(X x, Y y, Height max_height) noexcept
-      : x_size(x), y_size(y), h_size(max_height),
-        stacked_containers(
-            std::vector<std::optional<Container>>(x * y * max_height)),
-        stacked_compartment_sizes(std::vector<size_t>(x * y, 0)),
-        position_list_(
-            std::vector<std::list<std::reference_wrapper<const Container>>>(
-                x * y)) {}
+      : x_size(x), y_size(y), h_size(max_height), columns_({x, y}),
+        region_index_(std::make_shared<RegionIndex>(
+            RegionIndex{FenwickTree3D<int>(x, y, 0), {}})) {}
 
   Ship(X x, Y y, Height max_height,
        std::vector<std::tuple<X, Y, Height>> restrictions) noexcept(false)
@@ -268,51 +920,135 @@ public:
     groupingFunctions_ = std::move(groupingFunctions);
   }
 
+  Ship(X x, Y y, Height max_height,
+       std::vector<std::tuple<X, Y, Height>> restrictions,
+       Grouping<Container> groupingFunctions,
+       Measures<Container> measureFunctions) noexcept(false)
+      : Ship(x, y, max_height, restrictions, std::move(groupingFunctions)) {
+    measureFunctions_ = std::move(measureFunctions);
+    for (const auto &measure_pair : measureFunctions_) {
+      region_index_->measures[measure_pair.first] =
+          FenwickTree3D<long long>(x, y, 0);
+    }
+  }
+
+  // containers of different heights: max_height and the restrictions are
+  // then in the sub-units of heightFunction, while z in positions and views
+  // stays the index of the container in its stack
+  Ship(X x, Y y, Height max_height,
+       std::vector<std::tuple<X, Y, Height>> restrictions,
+       Grouping<Container> groupingFunctions,
+       Measures<Container> measureFunctions,
+       ContainerHeight<Container> heightFunction) noexcept(false)
+      : Ship(x, y, max_height, restrictions, std::move(groupingFunctions),
+             std::move(measureFunctions)) {
+    heightFunction_ = std::move(heightFunction);
+  }
+
   void load(X x, Y y, Container c) noexcept(false) {
-    // TODO: (5) handle height of the container
+    TraceCall call(trace_.get(), TraceOp::Load);
+    if (auto record = call.record()) {
+      trace_load(*record, x, y, c);
+    }
     shipping::Position current_pos = shipping::Position(x, y);
-    auto &current_compartment_size = stacked_compartment_sizes[pos_index(x, y)];
-    if (restrictions_.find(current_pos) != restrictions_.end() &&
-        restrictions_[current_pos] <= current_compartment_size) {
+    auto current_compartment_size = column_size(x, y);
+    const auto &current_column = columns_[pos_index(x, y)];
+    int container_h = container_height(c);
+    int stacked_h = (current_column ? current_column->height : 0) + container_h;
+    if (container_h < 1) {
+      throw BadShipOperationException(std::to_string(__LINE__) + " : " +
+                                      std::to_string(container_h) +
+                                      ": bad container height");
+    }
+    auto restriction = restrictions_.find(current_pos);
+    if (restriction != restrictions_.end() && restriction->second < stacked_h) {
       throw BadShipOperationException(
           std::to_string(__LINE__) + " : " + std::to_string(x) + "," +
           std::to_string(y) +
-          ": has restriction : " + std::to_string(restrictions_[current_pos]));
+          ": has restriction : " + std::to_string(restriction->second));
     }
     // std::cout << "Load:" << __LINE__ << std::endl;
-    if (current_compartment_size == h_size) {
+    if (stacked_h > h_size) {
       throw BadShipOperationException(
           std::to_string(__LINE__) + " : " + std::to_string(x) + "," +
           std::to_string(y) + ": occupied compartment");
     }
 
-    auto &container =
-        stacked_containers[pos_index(x, y, (Height)(current_compartment_size))];
+    {
+      auto shared = lock_shared();
+      checkSegregations(x, y, c);
+    }
+
+    auto &column = mutable_column(x, y);
+    if (column.slots.size() == current_compartment_size) {
+      column.slots.emplace_back();
+    }
+    column.slots[current_compartment_size] = std::move(c);
+    {
+      auto shared = lock_shared();
+      addContainerToGroups(x, y, (Height)current_compartment_size);
+      addContainerToRegionIndex(x, y, (Height)current_compartment_size);
+      publishPositionDelta(DeltaKind::Insert, x, y,
+                           (Height)current_compartment_size);
+    }
+    column.height += container_h;
+    column.size++;
+  }
 
-    container = std::move(c);
-    addContainerToGroups(x, y, (Height)current_compartment_size);
-    addContainerToPList(x, y, (Height)current_compartment_size);
-    current_compartment_size++;
+  // loads (x, y, container) entries in order, moving the containers out of
+  // batch; an entry that load rejects is passed to onError(index, exception)
+  // and skipped. Returns the number of containers loaded.
+  template <typename OnError>
+  size_t loadBatch(std::vector<std::tuple<X, Y, Container>> &batch,
+                   OnError onError) {
+    size_t loaded = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+      auto &[x, y, c] = batch[i];
+      try {
+        load(x, y, std::move(c));
+        ++loaded;
+      } catch (const BadShipOperationException &e) {
+        onError(i, e);
+      }
+    }
+    return loaded;
   }
 
   Container unload(X x, Y y) noexcept(false) {
-    auto &current_compartment_size = stacked_compartment_sizes[pos_index(x, y)];
-    auto unload_index = current_compartment_size - 1;
-    if (unload_index == -1) {
+    TraceCall call(trace_.get(), TraceOp::Unload);
+    if (auto record = call.record()) {
+      record->x = x;
+      record->y = y;
+    }
+    auto current_compartment_size = column_size(x, y);
+    if (current_compartment_size == 0) {
       throw BadShipOperationException(
           std::to_string(__LINE__) + " : " + std::to_string(x) + "," +
           std::to_string(y) + ": no container to unload");
     }
-    removeContainerFromGroups(x, y, (Height)unload_index);
-    removeContainerFromPList(x, y, (Height)unload_index);
-    auto &unload_container =
-        stacked_containers[pos_index(x, y, (Height)unload_index)];
+    auto unload_index = current_compartment_size - 1;
+    {
+      auto shared = lock_shared();
+      removeContainerFromGroups(x, y, (Height)unload_index);
+      removeContainerFromRegionIndex(x, y, (Height)unload_index);
+      publishPositionDelta(DeltaKind::Remove, x, y, (Height)unload_index);
+    }
+    auto &column = mutable_column(x, y);
+    auto &unload_container = column.slots[unload_index];
     auto empty_container = std::optional<Container>{};
     std::swap(unload_container, empty_container);
-    current_compartment_size--;
+    column.height -= container_height(*empty_container);
+    column.size--;
     return empty_container.value();
   }
   void move(X from_x, Y from_y, X to_x, Y to_y) noexcept(false) {
+    TraceCall call(trace_.get(), TraceOp::Move);
+    if (auto record = call.record()) {
+      record->x = from_x;
+      record->y = from_y;
+      record->to_x = to_x;
+      record->to_y = to_y;
+    }
     auto from_container = unload(from_x, from_y);
     try {
       load(to_x, to_y, from_container);
@@ -323,8 +1059,14 @@ public:
   }
 
   // TODO: (8) verify if this works out of box from ExamHall
+  // entries are ViewEntry values, in no particular order
   GroupView getContainersViewByGroup(const std::string &groupingName,
                                      const std::string &groupName) const {
+    TraceCall call(trace_.get(), TraceOp::GroupView);
+    if (auto record = call.record()) {
+      record->grouping = groupingName;
+      record->group = groupName;
+    }
     auto itr = groups.find(groupingName);
     if (itr == groups.end() &&
         groupingFunctions_.find(groupingName) != groupingFunctions_.end()) {
@@ -344,49 +1086,329 @@ public:
       auto itr2 = grouping.find(groupName);
       if (itr2 == grouping.end()) {
         std::tie(itr2, std::ignore) =
-            itr->second.insert({groupName, Pos3D2Container{}});
+            itr->second.insert({groupName, GroupSlot{}});
         //--------------------------------------------------------------------
         // OR, with auto tuple unpack
         //--------------------------------------------------------------------
         // auto [insert_itr, _] = itr->second.insert({groupName,
-        // Pos2Container{}}); itr2 = insert_itr;
+        // GroupSlot{}}); itr2 = insert_itr;
       }
-      return GroupView{itr2->second};
+      return GroupView{itr2->second, columns_.data(), columns_.indexer()};
     }
     return GroupView{0};
   }
   // TODO: (9) implement API
   PositionView getContainersViewByPosition(X x, Y y) const {
+    TraceCall call(trace_.get(), TraceOp::PositionView);
+    if (auto record = call.record()) {
+      record->x = x;
+      record->y = y;
+    }
     try {
-      return PositionView{position_list_[pos_index(x, y)]};
+      return PositionView{columns_[pos_index(x, y)]};
     } catch (...) {
       ;
     }
     return PositionView{0};
   }
+  // Keeps every group of the grouping ordered from now on, by the measure or,
+  // with no measure name, by (x, y, z); see getContainersViewByGroupOrdered.
+  // Throws for an unknown grouping or measure.
+  void orderGroupsBy(const std::string &groupingName,
+                     const std::string &measureName = "") noexcept(false) {
+    TraceCall call(trace_.get(), TraceOp::OrderGroups);
+    if (auto record = call.record()) {
+      record->grouping = groupingName;
+      record->measure = measureName;
+    }
+    if (groupingFunctions_.find(groupingName) == groupingFunctions_.end() ||
+        (!measureName.empty() &&
+         measureFunctions_.find(measureName) == measureFunctions_.end())) {
+      throw BadShipOperationException(std::to_string(__LINE__) + " : " +
+                                      groupingName + "," + measureName +
+                                      ": bad group order");
+    }
+    orderings_[groupingName] = measureName;
+    for (auto &group : groups[groupingName]) {
+      auto ordered = std::make_shared<OrderedMembers>();
+      for (const auto &pos : group.second.members->positions) {
+        ordered->insert(ordered_entry(
+            measureName,
+            get_container(std::get<0>(pos), std::get<1>(pos), std::get<2>(pos)),
+            pos));
+      }
+      group.second.ordered = std::move(ordered);
+    }
+  }
+  // the group in the order set by orderGroupsBy, kept up to date by load and
+  // unload; throws if the grouping is not ordered
+  OrderedGroupView
+  getContainersViewByGroupOrdered(const std::string &groupingName,
+                                  const std::string &groupName) const
+      noexcept(false) {
+    if (orderings_.find(groupingName) == orderings_.end()) {
+      throw BadShipOperationException(std::to_string(__LINE__) + " : " +
+                                      groupingName + ": grouping not ordered");
+    }
+    auto itr = groups.find(groupingName);
+    if (itr != groups.end()) {
+      auto itr2 = itr->second.find(groupName);
+      if (itr2 != itr->second.end() && itr2->second.ordered) {
+        return OrderedGroupView{*itr2->second.ordered, columns_.data(),
+                                columns_.indexer()};
+      }
+    }
+    return OrderedGroupView{0};
+  }
+
+  // stacked height of the column, in container height sub-units
+  int columnHeight(X x, Y y) const noexcept(false) {
+    const auto &column = columns_[pos_index(x, y)];
+    return column ? column->height : 0;
+  }
+
+  // Rejects, from now on, every load or move that would break the
+  // constraint. Throws if the grouping is unknown, the distance negative or
+  // the cargo already on board breaks it.
+  void addSegregationConstraint(SegregationConstraint constraint) noexcept(
+      false) {
+    TraceCall call(trace_.get(), TraceOp::Segregate);
+    if (auto record = call.record()) {
+      record->grouping = constraint.groupingName;
+      record->group = constraint.groupA;
+      record->other_group = constraint.groupB;
+      record->distance = constraint.distance;
+    }
+    if (groupingFunctions_.find(constraint.groupingName) ==
+            groupingFunctions_.end() ||
+        constraint.distance < 0) {
+      throw BadShipOperationException(
+          std::to_string(__LINE__) + " : " + constraint.groupingName +
+          ": bad segregation constraint");
+    }
+    Segregation segregation{constraint, std::vector<int>(columns_.size(), 0),
+                            std::vector<int>(columns_.size(), 0)};
+    auto &grouping = groups[constraint.groupingName];
+    auto members_of = [&](const std::string &groupName) {
+      auto itr = grouping.find(groupName);
+      return itr == grouping.end() ? std::vector<Position3D>{}
+                                   : itr->second.members->positions;
+    };
+    auto members_a = members_of(constraint.groupA);
+    auto members_b = members_of(constraint.groupB);
+    for (const auto &pos : members_a) {
+      spreadSegregation(segregation, segregation.near_a, std::get<0>(pos),
+                        std::get<1>(pos), 1);
+    }
+    for (const auto &pos : members_b) {
+      spreadSegregation(segregation, segregation.near_b, std::get<0>(pos),
+                        std::get<1>(pos), 1);
+    }
+    // with groupA == groupB every member counts itself once
+    int allowed = constraint.groupA == constraint.groupB ? 1 : 0;
+    for (const auto &pos : members_a) {
+      if (segregation.near_b[pos_index(std::get<0>(pos), std::get<1>(pos))] >
+          allowed) {
+        throw BadShipOperationException(
+            std::to_string(__LINE__) + " : " +
+            std::to_string(std::get<0>(pos)) + "," +
+            std::to_string(std::get<1>(pos)) + ": segregation of " +
+            constraint.groupA + " and " + constraint.groupB +
+            " already broken");
+      }
+    }
+    mutable_segregations().push_back(std::move(segregation));
+  }
+  // largest distance of any segregation constraint, -1 if there are none;
+  // operations on columns further apart than that do not interact
+  int segregationDistance() const {
+    int distance = -1;
+    for (const auto &segregation : *segregations_) {
+      distance = std::max(distance, segregation.constraint.distance);
+    }
+    return distance;
+  }
+
+  // Events for every later insert into / remove from the group, so a view
+  // can be followed without rescanning it. The ring holds `capacity` events;
+  // a subscriber that falls further behind is told so by poll().
+  // Subscribing is const but creates the stream on first use: subscribe on
+  // the thread that loads and unloads the ship. Only poll() is lock free
+  // and may run on any thread.
+  DeltaSubscription subscribeToGroup(const std::string &groupingName,
+                                     const std::string &groupName,
+                                     size_t capacity = 1024) const {
+    if (groupingFunctions_.find(groupingName) == groupingFunctions_.end()) {
+      return DeltaSubscription{};
+    }
+    auto &group = groups[groupingName][groupName];
+    if (!group.stream) {
+      group.stream = std::make_shared<DeltaStream>(capacity);
+    }
+    return DeltaSubscription{group.stream};
+  }
+  DeltaSubscription subscribeToPosition(X x, Y y,
+                                        size_t capacity = 1024) const {
+    size_t index = pos_index(x, y);
+    if (position_streams_.empty()) {
+      position_streams_.resize(columns_.size());
+    }
+    auto &stream = position_streams_[index];
+    if (!stream) {
+      stream = std::make_shared<DeltaStream>(capacity);
+    }
+    return DeltaSubscription{stream};
+  }
+
+  // all containers in the inclusive box (x1..x2, y1..y2, z1..z2), column by
+  // column and bottom up inside each column, as ViewEntry values
+  RegionView getContainersViewByRegion(X x1, Y y1, Height z1, X x2, Y y2,
+                                       Height z2) const {
+    int from_x = x1, from_y = y1, from_z = z1;
+    int to_x = x2, to_y = y2, to_z = z2;
+    if (!clamp_region(from_x, from_y, from_z, to_x, to_y, to_z)) {
+      return RegionView{0};
+    }
+    auto make_itr = [&](bool end) {
+      return RegionIterator(columns_.data(), columns_.indexer(), from_x,
+                            from_y, from_z, to_x, to_y, to_z, end);
+    };
+    return RegionView{make_itr(false), make_itr(true)};
+  }
+  RegionView getContainersViewByRegion(X x1, Y y1, X x2, Y y2) const {
+    return getContainersViewByRegion(x1, y1, Height{0}, x2, y2,
+                                     Height{h_size - 1});
+  }
+
+  size_t countContainersByRegion(X x1, Y y1, Height z1, X x2, Y y2,
+                                 Height z2) const {
+    int from_x = x1, from_y = y1, from_z = z1;
+    int to_x = x2, to_y = y2, to_z = z2;
+    if (!clamp_region(from_x, from_y, from_z, to_x, to_y, to_z)) {
+      return 0;
+    }
+    return region_index_->occupancy.sum(from_x, from_y, from_z, to_x, to_y,
+                                        to_z);
+  }
+  size_t countContainersByRegion(X x1, Y y1, X x2, Y y2) const {
+    return countContainersByRegion(x1, y1, Height{0}, x2, y2,
+                                   Height{h_size - 1});
+  }
+
+  // sum of a measure given at construction, 0 for an unknown measure
+  long long sumByRegion(const std::string &measureName, X x1, Y y1, Height z1,
+                        X x2, Y y2, Height z2) const {
+    auto itr = region_index_->measures.find(measureName);
+    int from_x = x1, from_y = y1, from_z = z1;
+    int to_x = x2, to_y = y2, to_z = z2;
+    if (itr == region_index_->measures.end() ||
+        !clamp_region(from_x, from_y, from_z, to_x, to_y, to_z)) {
+      return 0;
+    }
+    return itr->second.sum(from_x, from_y, from_z, to_x, to_y, to_z);
+  }
+  long long sumByRegion(const std::string &measureName, X x1, Y y1, X x2,
+                        Y y2) const {
+    return sumByRegion(measureName, x1, y1, Height{0}, x2, y2,
+                       Height{h_size - 1});
+  }
 
   GroupIterator begin() const {
-    return {stacked_containers.begin(), stacked_containers.end()};
+    TraceCall call(trace_.get(), TraceOp::Iterate);
+    return {columns_.data(), columns_.data() + columns_.size()};
   }
   GroupIterator end() const {
-    return {stacked_containers.end(), stacked_containers.end()};
+    return {columns_.data() + columns_.size(),
+            columns_.data() + columns_.size()};
+  }
+
+  // up to n slices of whole columns, for parallel scans of all containers
+  std::vector<RangeView<GroupIterator>> split(size_t n) const {
+    std::vector<RangeView<GroupIterator>> chunks;
+    const ColumnPtr *first = columns_.data();
+    size_t total = columns_.size();
+    n = std::max<size_t>(1, std::min(n, total));
+    for (size_t i = 0; i < n; ++i) {
+      const ColumnPtr *from = first + total * i / n;
+      const ColumnPtr *to = first + total * (i + 1) / n;
+      chunks.emplace_back(GroupIterator{from, to}, GroupIterator{to, to});
+    }
+    return chunks;
+  }
+
+  // Records the cargo on board, the group orderings and the segregation
+  // constraints, then every later load, unload, move, group and position
+  // view, full iteration, ordering and constraint to out, until stopTrace;
+  // ShipReplay.h runs the trace again. A fork or copy of the ship is not
+  // traced.
+  void startTrace(std::ostream &out) {
+    TraceHeader header{
+        x_size, y_size, h_size, {}, {}, bool(heightFunction_), {}, {}, {}, {}};
+    for (const auto &restriction : restrictions_) {
+      header.restrictions.emplace_back(std::get<0>(restriction.first),
+                                       std::get<1>(restriction.first),
+                                       restriction.second);
+    }
+    for (const auto &group_pair : groupingFunctions_) {
+      header.groupings.push_back(group_pair.first);
+    }
+    for (const auto &measure_pair : measureFunctions_) {
+      header.measures.push_back(measure_pair.first);
+    }
+    for (const auto &ordering : orderings_) {
+      header.orderings.push_back(ordering);
+    }
+    for (const auto &segregation : *segregations_) {
+      const auto &constraint = segregation.constraint;
+      TraceRecord record;
+      record.op = TraceOp::Segregate;
+      record.grouping = constraint.groupingName;
+      record.group = constraint.groupA;
+      record.other_group = constraint.groupB;
+      record.distance = constraint.distance;
+      header.segregations.push_back(std::move(record));
+    }
+    for (int x = 0; x < x_size; ++x) {
+      for (int y = 0; y < y_size; ++y) {
+        const auto &column = columns_[pos_index(X{x}, Y{y})];
+        for (size_t z = 0; column && z < column->size; ++z) {
+          TraceRecord record;
+          record.op = TraceOp::Load;
+          trace_load(record, X{x}, Y{y}, *column->slots[z]);
+          header.cargo.push_back(std::move(record));
+        }
+      }
+    }
+    trace_ = std::make_shared<TraceRecorder>(out, header);
   }
+  void stopTrace() { trace_ = nullptr; }
+
+  // a copy-on-write fork: columns and group storage stay shared with this
+  // ship until either side writes to them, so forking costs one pointer copy
+  // per column and per group. The region index and the segregation counters
+  // are shared whole: the first write on either side after a fork copies
+  // them, x * y * z counters per measure plus one, and 2 * x * y per
+  // segregation constraint, so a branch that writes at all costs O(ship)
+  // once. References to containers obtained before the fork may point at
+  // the storage of the other side after a later write.
+  Ship fork() const { return Ship(*this, ForkTag{}); }
 
   //-------------------------------------------------------
   // Note:
   //-------------------------------------------------------
-  // relying on move to keep validity of references to items in container
-  // this is not guarenteed by the spec (yet) but there is almost no way
-  // not to support that, as swap(vec1, vec2) must guarentee validity of
-  // references see:
-  // https://stackoverflow.com/questions/11021764/does-moving-a-vector-invalidate-iterators
-  // and:
-  // https://stackoverflow.com/questions/25347599/am-i-guaranteed-that-pointers-to-stdvector-elements-are-valid-after-the-vector
-  // see also - spec open proposal:
-  // http://www.open-std.org/jtc1/sc22/wg21/docs/lwg-active.html#2321
+  // indexes hold positions rather than references, so a copy is a straight
+  // copy of the storage with no fix-ups, and it shares nothing with the
+  // original. Views point into the column buffer and the group slots, which
+  // a move hands over as they are: views taken before a move read the
+  // moved-to ship.
   //-------------------------------------------------------
-  Ship(const Ship &) = delete;
-  Ship &operator=(const Ship &) = delete;
+  Ship(const Ship &other) : Ship(other, ForkTag{}) { unshare(); }
+  Ship &operator=(const Ship &other) {
+    if (this != &other) {
+      *this = Ship(other);
+    }
+    return *this;
+  }
   Ship(Ship &&) = default;
   Ship &operator=(Ship &&) = default;
   //-------------------------------------------------------
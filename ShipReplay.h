@@ -0,0 +1,173 @@
+// =====================================
+// ShipReplay - Assignment 4
+// re-runs a recorded ship trace and measures it
+// =====================================
+#pragma once
+
+#include "Ship.h"
+#include "ShipTrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace shipping {
+struct ReplayReport {
+  size_t calls = 0;
+  size_t failures = 0;
+  // calls that failed in the trace but not in the replay, or the other way
+  size_t diverged = 0;
+  std::chrono::nanoseconds wall_time{0};
+  // per call, sorted
+  std::vector<std::chrono::nanoseconds> latencies;
+  // containers seen by views and iterations, keeps them from being elided
+  size_t visited = 0;
+
+  std::chrono::nanoseconds percentile(double p) const {
+    if (latencies.empty()) {
+      return std::chrono::nanoseconds{0};
+    }
+    auto rank = size_t(p / 100 * (latencies.size() - 1) + 0.5);
+    return latencies[std::min(rank, latencies.size() - 1)];
+  }
+};
+
+// A container that carries the groups and measures it had when recorded,
+// so a replayed ship builds the same indexes whatever the original
+// container type was.
+struct TracedContainer {
+  std::vector<std::string> groups;
+  std::vector<long long> measures;
+  int height = 1;
+
+  // the container of a Load record
+  static TracedContainer of(const TraceRecord &record) {
+    return TracedContainer{record.groups, record.measures, record.height};
+  }
+};
+
+// an empty ship of TracedContainer with the size, restrictions, groupings,
+// measures and height mode of the traced ship
+inline Ship<TracedContainer> makeReplayShip(const TraceHeader &header) {
+  std::vector<std::tuple<X, Y, Height>> restrictions;
+  for (const auto &[x, y, h] : header.restrictions) {
+    restrictions.emplace_back(X{x}, Y{y}, Height{h});
+  }
+  Grouping<TracedContainer> groupingFunctions;
+  for (size_t i = 0; i < header.groupings.size(); ++i) {
+    groupingFunctions[header.groupings[i]] =
+        [i](const TracedContainer &c) { return c.groups[i]; };
+  }
+  Measures<TracedContainer> measureFunctions;
+  for (size_t i = 0; i < header.measures.size(); ++i) {
+    measureFunctions[header.measures[i]] =
+        [i](const TracedContainer &c) { return c.measures[i]; };
+  }
+  ContainerHeight<TracedContainer> heightFunction;
+  if (header.heights) {
+    heightFunction = [](const TracedContainer &c) { return c.height; };
+  }
+  return Ship<TracedContainer>{X{header.x_size}, Y{header.y_size},
+                               Height{header.h_size}, restrictions,
+                               groupingFunctions, measureFunctions,
+                               heightFunction};
+}
+
+// Puts the ship as it was when recording started on ship, an empty ship
+// built from the header: its cargo, group orderings and segregation
+// constraints. Throws std::runtime_error if ship does not take them.
+template <typename Ship, typename MakeContainer>
+void restoreTraceState(const TraceHeader &header, Ship &ship,
+                       MakeContainer makeContainer) {
+  try {
+    for (const auto &record : header.cargo) {
+      ship.load(X{record.x}, Y{record.y}, makeContainer(record));
+    }
+    for (const auto &[grouping, measure] : header.orderings) {
+      ship.orderGroupsBy(grouping, measure);
+    }
+    for (const auto &record : header.segregations) {
+      ship.addSegregationConstraint(
+          {record.grouping, record.group, record.other_group, record.distance});
+    }
+  } catch (const BadShipOperationException &e) {
+    throw std::runtime_error("trace state does not fit the ship: " +
+                             e.message());
+  }
+}
+
+// Restores the state in the trace header on ship, see restoreTraceState,
+// then runs the trace against it, as fast as possible or, with
+// originalTiming, starting every call no earlier than it started when
+// recorded. makeContainer(record) builds the container of a Load record.
+template <typename Ship, typename MakeContainer>
+ReplayReport replayTrace(TraceReader &reader, Ship &ship,
+                         MakeContainer makeContainer,
+                         bool originalTiming = false) {
+  using clock = std::chrono::steady_clock;
+  restoreTraceState(reader.header(), ship, makeContainer);
+  ReplayReport report;
+  TraceRecord record;
+  auto started = clock::now();
+  while (reader.next(record)) {
+    if (originalTiming) {
+      std::this_thread::sleep_until(started + record.time);
+    }
+    auto container = record.op == TraceOp::Load
+                         ? std::optional(makeContainer(record))
+                         : std::nullopt;
+    bool failed = false;
+    auto call_started = clock::now();
+    try {
+      switch (record.op) {
+      case TraceOp::Load:
+        ship.load(X{record.x}, Y{record.y}, std::move(*container));
+        break;
+      case TraceOp::Unload:
+        ship.unload(X{record.x}, Y{record.y});
+        break;
+      case TraceOp::Move:
+        ship.move(X{record.x}, Y{record.y}, X{record.to_x}, Y{record.to_y});
+        break;
+      case TraceOp::GroupView:
+        report.visited +=
+            ship.getContainersViewByGroup(record.grouping, record.group)
+                .size();
+        break;
+      case TraceOp::PositionView: {
+        auto view = ship.getContainersViewByPosition(X{record.x}, Y{record.y});
+        report.visited += view.begin() != view.end();
+        break;
+      }
+      case TraceOp::Iterate:
+        for (const auto &container : ship) {
+          (void)container;
+          ++report.visited;
+        }
+        break;
+      case TraceOp::Segregate:
+        ship.addSegregationConstraint({record.grouping, record.group,
+                                       record.other_group, record.distance});
+        break;
+      case TraceOp::OrderGroups:
+        ship.orderGroupsBy(record.grouping, record.measure);
+        break;
+      }
+    } catch (const BadShipOperationException &) {
+      failed = true;
+    }
+    report.latencies.push_back(clock::now() - call_started);
+    ++report.calls;
+    report.failures += failed;
+    report.diverged += failed != record.failed;
+  }
+  report.wall_time = clock::now() - started;
+  std::sort(report.latencies.begin(), report.latencies.end());
+  return report;
+}
+} // namespace shipping
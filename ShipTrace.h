@@ -0,0 +1,375 @@
+// =====================================
+// ShipTrace - Assignment 4
+// binary trace of the public calls on a ship
+// =====================================
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace shipping {
+enum class TraceOp : std::uint8_t {
+  Load,
+  Unload,
+  Move,
+  GroupView,
+  PositionView,
+  Iterate,
+  Segregate,
+  OrderGroups
+};
+
+struct TraceRecord {
+  // since recording started
+  std::chrono::nanoseconds time{0};
+  TraceOp op = TraceOp::Iterate;
+  // the call threw: the ship rejected it (BadShipOperationException) or a
+  // grouping, measure or height function failed. Replay only counts the
+  // first kind as failures, so the second shows up as diverged.
+  bool failed = false;
+  int x = 0;
+  int y = 0;
+  int to_x = 0;
+  int to_y = 0;
+  // Load: the container's height, its group in every grouping and its value
+  // of every measure
+  int height = 1;
+  std::vector<std::string> groups;
+  std::vector<long long> measures;
+  // GroupView, Segregate and OrderGroups
+  std::string grouping;
+  // GroupView; Segregate: groupA
+  std::string group;
+  // Segregate
+  std::string other_group;
+  int distance = 0;
+  // OrderGroups, empty for (x, y, z) order
+  std::string measure;
+};
+
+// what replay needs to rebuild an equivalent ship, as it was when recording
+// started
+struct TraceHeader {
+  int x_size = 0;
+  int y_size = 0;
+  int h_size = 0;
+  std::vector<std::tuple<int, int, int>> restrictions;
+  // in the order of TraceRecord::groups
+  std::vector<std::string> groupings;
+  // whether TraceRecord::height is in sub-units, see ContainerHeight
+  bool heights = false;
+  // in the order of TraceRecord::measures
+  std::vector<std::string> measures;
+  // grouping and measure of every orderGroupsBy in force
+  std::vector<std::pair<std::string, std::string>> orderings;
+  // Segregate records of the constraints in force
+  std::vector<TraceRecord> segregations;
+  // Load records of the containers on board, bottom up in every column
+  std::vector<TraceRecord> cargo;
+};
+
+// Trace layout, native byte order: "SHTR", version, the header, then one
+// record per call - time (u64 ns), op (u8), failed (u8) and the operands of
+// the op, strings as u16 length and bytes. Readers take only the current
+// version. Not thread safe, like the ship writing it.
+class TraceRecorder {
+  static constexpr std::size_t flush_bytes = std::size_t{1} << 16;
+
+  std::ostream &out_;
+  std::string buffer_;
+  std::chrono::steady_clock::time_point started_;
+  int depth_ = 0;
+  TraceRecord record_;
+
+  template <typename T> void put(T value) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    buffer_.append(bytes, sizeof(T));
+  }
+  void put(const std::string &s) {
+    auto length = std::uint16_t(std::min<std::size_t>(s.size(), UINT16_MAX));
+    put(length);
+    buffer_.append(s.data(), length);
+  }
+  void put_operands(const TraceRecord &record) {
+    switch (record.op) {
+    case TraceOp::Load:
+      put(std::int32_t(record.x));
+      put(std::int32_t(record.y));
+      put(std::int32_t(record.height));
+      for (const auto &group : record.groups) {
+        put(group);
+      }
+      for (auto value : record.measures) {
+        put(std::int64_t(value));
+      }
+      break;
+    case TraceOp::Move:
+      put(std::int32_t(record.x));
+      put(std::int32_t(record.y));
+      put(std::int32_t(record.to_x));
+      put(std::int32_t(record.to_y));
+      break;
+    case TraceOp::Unload:
+    case TraceOp::PositionView:
+      put(std::int32_t(record.x));
+      put(std::int32_t(record.y));
+      break;
+    case TraceOp::GroupView:
+      put(record.grouping);
+      put(record.group);
+      break;
+    case TraceOp::Iterate:
+      break;
+    case TraceOp::Segregate:
+      put(record.grouping);
+      put(record.group);
+      put(record.other_group);
+      put(std::int32_t(record.distance));
+      break;
+    case TraceOp::OrderGroups:
+      put(record.grouping);
+      put(record.measure);
+      break;
+    }
+  }
+
+public:
+  static constexpr std::uint32_t version = 2;
+
+  TraceRecorder(std::ostream &out, const TraceHeader &header)
+      : out_(out), started_(std::chrono::steady_clock::now()) {
+    buffer_.append("SHTR", 4);
+    put(version);
+    put(std::int32_t(header.x_size));
+    put(std::int32_t(header.y_size));
+    put(std::int32_t(header.h_size));
+    put(std::uint8_t(header.heights));
+    put(std::uint32_t(header.restrictions.size()));
+    for (const auto &[x, y, h] : header.restrictions) {
+      put(std::int32_t(x));
+      put(std::int32_t(y));
+      put(std::int32_t(h));
+    }
+    put(std::uint32_t(header.groupings.size()));
+    for (const auto &grouping : header.groupings) {
+      put(grouping);
+    }
+    put(std::uint32_t(header.measures.size()));
+    for (const auto &measure : header.measures) {
+      put(measure);
+    }
+    put(std::uint32_t(header.orderings.size()));
+    for (const auto &[grouping, measure] : header.orderings) {
+      put(grouping);
+      put(measure);
+    }
+    put(std::uint32_t(header.segregations.size()));
+    for (const auto &record : header.segregations) {
+      put_operands(record);
+    }
+    put(std::uint32_t(header.cargo.size()));
+    for (const auto &record : header.cargo) {
+      put_operands(record);
+    }
+  }
+  ~TraceRecorder() { flush(); }
+  TraceRecorder(const TraceRecorder &) = delete;
+  TraceRecorder &operator=(const TraceRecorder &) = delete;
+
+  // a call starts; true for an outermost call, which is then recorded -
+  // a move's own unload and load are not
+  bool enter(TraceOp op) {
+    if (depth_++ > 0) {
+      return false;
+    }
+    record_.time = std::chrono::steady_clock::now() - started_;
+    record_.op = op;
+    record_.groups.clear();
+    record_.measures.clear();
+    return true;
+  }
+  // operands of the outermost call
+  TraceRecord &record() { return record_; }
+  void leave(bool recorded, bool failed) {
+    --depth_;
+    if (!recorded) {
+      return;
+    }
+    put(std::uint64_t(record_.time.count()));
+    put(std::uint8_t(record_.op));
+    put(std::uint8_t(failed));
+    put_operands(record_);
+    if (buffer_.size() >= flush_bytes) {
+      flush();
+    }
+  }
+  void flush() {
+    out_.write(buffer_.data(), buffer_.size());
+    out_.flush();
+    buffer_.clear();
+  }
+};
+
+// scope of one traced call; recorder may be null
+class TraceCall {
+  TraceRecorder *recorder_;
+  bool recorded_ = false;
+  int exceptions_ = std::uncaught_exceptions();
+
+public:
+  TraceCall(TraceRecorder *recorder, TraceOp op) : recorder_(recorder) {
+    recorded_ = recorder_ && recorder_->enter(op);
+  }
+  ~TraceCall() {
+    if (recorder_) {
+      recorder_->leave(recorded_, std::uncaught_exceptions() > exceptions_);
+    }
+  }
+  TraceCall(const TraceCall &) = delete;
+  TraceCall &operator=(const TraceCall &) = delete;
+
+  // null unless this call is recorded
+  TraceRecord *record() const {
+    return recorded_ ? &recorder_->record() : nullptr;
+  }
+};
+
+class TraceReader {
+  std::istream &in_;
+  TraceHeader header_;
+
+  template <typename T> T get() {
+    char bytes[sizeof(T)];
+    if (!in_.read(bytes, sizeof(T))) {
+      throw std::runtime_error("truncated trace");
+    }
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+  }
+  std::string get_string() {
+    std::string s(get<std::uint16_t>(), '\0');
+    if (!s.empty() && !in_.read(&s[0], s.size())) {
+      throw std::runtime_error("truncated trace");
+    }
+    return s;
+  }
+  void get_operands(TraceRecord &record) {
+    switch (record.op) {
+    case TraceOp::Load:
+      record.x = get<std::int32_t>();
+      record.y = get<std::int32_t>();
+      record.height = get<std::int32_t>();
+      record.groups.resize(header_.groupings.size());
+      for (auto &group : record.groups) {
+        group = get_string();
+      }
+      record.measures.resize(header_.measures.size());
+      for (auto &value : record.measures) {
+        value = get<std::int64_t>();
+      }
+      break;
+    case TraceOp::Move:
+      record.x = get<std::int32_t>();
+      record.y = get<std::int32_t>();
+      record.to_x = get<std::int32_t>();
+      record.to_y = get<std::int32_t>();
+      break;
+    case TraceOp::Unload:
+    case TraceOp::PositionView:
+      record.x = get<std::int32_t>();
+      record.y = get<std::int32_t>();
+      break;
+    case TraceOp::GroupView:
+      record.grouping = get_string();
+      record.group = get_string();
+      break;
+    case TraceOp::Iterate:
+      break;
+    case TraceOp::Segregate:
+      record.grouping = get_string();
+      record.group = get_string();
+      record.other_group = get_string();
+      record.distance = get<std::int32_t>();
+      break;
+    case TraceOp::OrderGroups:
+      record.grouping = get_string();
+      record.measure = get_string();
+      break;
+    default:
+      throw std::runtime_error("bad trace record");
+    }
+  }
+  // header records carry no time or outcome
+  TraceRecord get_header_record(TraceOp op) {
+    TraceRecord record;
+    record.op = op;
+    get_operands(record);
+    return record;
+  }
+
+public:
+  explicit TraceReader(std::istream &in) : in_(in) {
+    char magic[4];
+    if (!in_.read(magic, 4) || std::memcmp(magic, "SHTR", 4) != 0) {
+      throw std::runtime_error("not a ship trace");
+    }
+    auto version = get<std::uint32_t>();
+    if (version != TraceRecorder::version) {
+      throw std::runtime_error("unsupported ship trace version " +
+                               std::to_string(version));
+    }
+    header_.x_size = get<std::int32_t>();
+    header_.y_size = get<std::int32_t>();
+    header_.h_size = get<std::int32_t>();
+    header_.heights = get<std::uint8_t>() != 0;
+    for (auto n = get<std::uint32_t>(); n > 0; --n) {
+      int x = get<std::int32_t>();
+      int y = get<std::int32_t>();
+      int h = get<std::int32_t>();
+      header_.restrictions.emplace_back(x, y, h);
+    }
+    for (auto n = get<std::uint32_t>(); n > 0; --n) {
+      header_.groupings.push_back(get_string());
+    }
+    for (auto n = get<std::uint32_t>(); n > 0; --n) {
+      header_.measures.push_back(get_string());
+    }
+    for (auto n = get<std::uint32_t>(); n > 0; --n) {
+      auto grouping = get_string();
+      header_.orderings.emplace_back(std::move(grouping), get_string());
+    }
+    for (auto n = get<std::uint32_t>(); n > 0; --n) {
+      header_.segregations.push_back(get_header_record(TraceOp::Segregate));
+    }
+    for (auto n = get<std::uint32_t>(); n > 0; --n) {
+      header_.cargo.push_back(get_header_record(TraceOp::Load));
+    }
+  }
+
+  const TraceHeader &header() const { return header_; }
+
+  // false at the end of the trace
+  bool next(TraceRecord &record) {
+    if (in_.peek() == std::char_traits<char>::eof()) {
+      return false;
+    }
+    record.time = std::chrono::nanoseconds(get<std::uint64_t>());
+    record.op = TraceOp(get<std::uint8_t>());
+    record.failed = get<std::uint8_t>() != 0;
+    get_operands(record);
+    return true;
+  }
+};
+} // namespace shipping
@@ -0,0 +1,175 @@
+// =====================================
+// SortedRuns - Assignment 4
+// ordered multiset for the ordered group index
+// =====================================
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+namespace shipping {
+// A sorted sequence cut into runs of at most max_run contiguous values - a
+// flat, two level B-tree. The last value of every run is kept in one more
+// vector, so finding a run is a binary search over contiguous memory and
+// finding the value in it another; inserts and erases shift within a single
+// run. Iteration walks the runs in order, both ways.
+template <typename T, typename Compare = std::less<T>> class SortedRuns {
+  static constexpr std::size_t max_run = 128;
+
+  std::vector<std::vector<T>> runs_;
+  // back() of every run
+  std::vector<T> maxima_;
+  std::size_t size_ = 0;
+  Compare compare_;
+
+  // first run that may hold value, runs_.size() if value is past them all
+  std::size_t run_for(const T &value) const {
+    return std::lower_bound(maxima_.begin(), maxima_.end(), value, compare_) -
+           maxima_.begin();
+  }
+
+public:
+  class const_iterator {
+    const SortedRuns *owner_ = nullptr;
+    std::size_t run_ = 0;
+    std::size_t offset_ = 0;
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T *;
+    using reference = const T &;
+
+    const_iterator() {}
+    const_iterator(const SortedRuns *owner, std::size_t run,
+                   std::size_t offset)
+        : owner_(owner), run_(run), offset_(offset) {
+      if (owner_ && run_ < owner_->runs_.size() &&
+          offset_ == owner_->runs_[run_].size()) {
+        ++run_;
+        offset_ = 0;
+      }
+    }
+    const T &operator*() const { return owner_->runs_[run_][offset_]; }
+    const T *operator->() const { return &**this; }
+    const_iterator &operator++() {
+      if (++offset_ == owner_->runs_[run_].size()) {
+        ++run_;
+        offset_ = 0;
+      }
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator temp_obj = *this;
+      ++*this;
+      return temp_obj;
+    }
+    const_iterator &operator--() {
+      if (offset_ == 0) {
+        offset_ = owner_->runs_[--run_].size();
+      }
+      --offset_;
+      return *this;
+    }
+    const_iterator operator--(int) {
+      const_iterator temp_obj = *this;
+      --*this;
+      return temp_obj;
+    }
+    bool operator==(const const_iterator &other) const {
+      return run_ == other.run_ && offset_ == other.offset_;
+    }
+    bool operator!=(const const_iterator &other) const {
+      return !(*this == other);
+    }
+  };
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const_iterator begin() const { return {this, 0, 0}; }
+  const_iterator end() const { return {this, runs_.size(), 0}; }
+
+  // first value not before value
+  const_iterator lower_bound(const T &value) const {
+    std::size_t run = run_for(value);
+    if (run == runs_.size()) {
+      return end();
+    }
+    const auto &values = runs_[run];
+    return {this, run,
+            std::size_t(std::lower_bound(values.begin(), values.end(), value,
+                                         compare_) -
+                        values.begin())};
+  }
+  // first value after value
+  const_iterator upper_bound(const T &value) const {
+    std::size_t run =
+        std::upper_bound(maxima_.begin(), maxima_.end(), value, compare_) -
+        maxima_.begin();
+    if (run == runs_.size()) {
+      return end();
+    }
+    const auto &values = runs_[run];
+    return {this, run,
+            std::size_t(std::upper_bound(values.begin(), values.end(), value,
+                                         compare_) -
+                        values.begin())};
+  }
+
+  void insert(const T &value) {
+    ++size_;
+    if (runs_.empty()) {
+      runs_.push_back({value});
+      maxima_.push_back(value);
+      return;
+    }
+    std::size_t run = std::min(run_for(value), runs_.size() - 1);
+    auto &values = runs_[run];
+    values.insert(
+        std::upper_bound(values.begin(), values.end(), value, compare_), value);
+    maxima_[run] = values.back();
+    if (values.size() > max_run) {
+      auto middle = values.begin() + values.size() / 2;
+      std::vector<T> upper(middle, values.end());
+      values.erase(middle, values.end());
+      maxima_[run] = values.back();
+      maxima_.insert(maxima_.begin() + run + 1, upper.back());
+      runs_.insert(runs_.begin() + run + 1, std::move(upper));
+    }
+  }
+
+  // removes one value equivalent to value; false if there is none
+  bool erase(const T &value) {
+    std::size_t run = run_for(value);
+    if (run == runs_.size()) {
+      return false;
+    }
+    auto &values = runs_[run];
+    auto itr = std::lower_bound(values.begin(), values.end(), value, compare_);
+    if (itr == values.end() || compare_(value, *itr)) {
+      return false;
+    }
+    --size_;
+    values.erase(itr);
+    if (values.empty()) {
+      runs_.erase(runs_.begin() + run);
+      maxima_.erase(maxima_.begin() + run);
+      return true;
+    }
+    maxima_[run] = values.back();
+    // keep runs from thinning out, merge a small run into its successor
+    if (values.size() < max_run / 4 && run + 1 < runs_.size() &&
+        values.size() + runs_[run + 1].size() <= max_run) {
+      auto &next = runs_[run + 1];
+      next.insert(next.begin(), values.begin(), values.end());
+      runs_.erase(runs_.begin() + run);
+      maxima_.erase(maxima_.begin() + run);
+    }
+    return true;
+  }
+};
+} // namespace shipping
@@ -0,0 +1,189 @@
+// =====================================
+// ThreadPool - Assignment 4
+// work-stealing pool shared by fleets, manifest imports and parallel scans
+// =====================================
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace shipping {
+// Tasks that are waited for together: a group keeps its own count of
+// unfinished tasks and its own first exception, so callers sharing a pool,
+// and tasks waiting on tasks they submitted, only ever wait for their own.
+// Must outlive the wait on it.
+class TaskGroup {
+  friend class ThreadPool;
+  std::atomic<size_t> unfinished_{0};
+  std::mutex error_m_;
+  std::exception_ptr error_;
+
+public:
+  TaskGroup() = default;
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+};
+
+// every worker owns a deque: it pushes and pops its own tasks at the back
+// (LIFO, cache warm) and steals from the front of the others when idle
+class ThreadPool {
+  struct Task {
+    std::function<void()> f;
+    TaskGroup *group = nullptr;
+  };
+  struct Worker {
+    std::deque<Task> tasks;
+    std::mutex m;
+  };
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::mutex sleep_m_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  std::atomic<size_t> queued_{0};
+  std::atomic<size_t> next_worker_{0};
+  bool stop_ = false;
+
+  static const ThreadPool *&current_pool() {
+    static thread_local const ThreadPool *pool = nullptr;
+    return pool;
+  }
+  static size_t &current_index() {
+    static thread_local size_t index = 0;
+    return index;
+  }
+
+  bool pop(size_t index, Task &task) {
+    {
+      auto &own = *workers_[index];
+      std::lock_guard<std::mutex> lock(own.m);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        --queued_;
+        return true;
+      }
+    }
+    for (size_t i = 1; i < workers_.size(); ++i) {
+      auto &victim = *workers_[(index + i) % workers_.size()];
+      std::lock_guard<std::mutex> lock(victim.m);
+      if (!victim.tasks.empty()) {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        --queued_;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void run(Task &task) {
+    TaskGroup &group = *task.group;
+    try {
+      task.f();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(group.error_m_);
+      if (!group.error_) {
+        group.error_ = std::current_exception();
+      }
+    }
+    task.f = nullptr;
+    // the group may be gone as soon as its count reaches zero
+    if (--group.unfinished_ == 0) {
+      std::lock_guard<std::mutex> lock(sleep_m_);
+      done_cv_.notify_all();
+    }
+  }
+
+  void work(size_t index) {
+    current_pool() = this;
+    current_index() = index;
+    Task task;
+    while (true) {
+      if (pop(index, task)) {
+        run(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_m_);
+      work_cv_.wait(lock, [this] { return stop_ || queued_ > 0; });
+      if (stop_ && queued_ == 0) {
+        return;
+      }
+    }
+  }
+
+public:
+  explicit ThreadPool(
+      size_t threads = std::max(1u, std::thread::hardware_concurrency())) {
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; ++i) {
+      workers_.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+      threads_.emplace_back([this, i] { work(i); });
+    }
+  }
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_m_);
+      stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto &thread : threads_) {
+      thread.join();
+    }
+  }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t size() const { return workers_.size(); }
+
+  // tasks submitted from a worker go to its own deque, others round robin
+  void submit(TaskGroup &group, std::function<void()> task) {
+    size_t index = current_pool() == this
+                       ? current_index()
+                       : next_worker_++ % workers_.size();
+    ++group.unfinished_;
+    {
+      auto &worker = *workers_[index];
+      std::lock_guard<std::mutex> lock(worker.m);
+      worker.tasks.push_back({std::move(task), &group});
+      ++queued_;
+    }
+    std::lock_guard<std::mutex> lock(sleep_m_);
+    work_cv_.notify_one();
+  }
+
+  // blocks until every task of the group, including tasks submitted to it
+  // by its tasks, is done. The calling thread runs queued tasks of any group
+  // meanwhile, so a task may wait on a group of its own without tying up a
+  // worker. Rethrows the first exception thrown by a task of the group.
+  void wait(TaskGroup &group) {
+    Task task;
+    while (group.unfinished_ > 0) {
+      if (pop(current_pool() == this ? current_index() : 0, task)) {
+        run(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_m_);
+      done_cv_.wait(lock, [this, &group] {
+        return group.unfinished_ == 0 || queued_ > 0;
+      });
+    }
+    std::lock_guard<std::mutex> lock(group.error_m_);
+    if (group.error_) {
+      auto error = group.error_;
+      group.error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+};
+} // namespace shipping
@@ -0,0 +1,83 @@
+#include "ManifestImporter.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+using namespace shipping;
+using std::string;
+
+// usage: manifest_bench [lines] [manifest path]
+// writes a synthetic manifest, then loads it line by line with getline and
+// std::string fields, and again with ManifestImporter
+
+struct Cargo {
+	string id;
+	string port;
+	int weight;
+};
+
+Ship<Cargo> makeShip() {
+	Grouping<Cargo> groupingFunctions = {
+		{ "port", [](const Cargo& c){ return c.port; } }
+	};
+	return Ship<Cargo>{ X{100}, Y{100}, Height{100}, {}, groupingFunctions };
+}
+
+void report(const char* name, size_t lines, size_t loaded, double seconds) {
+	std::printf("%-10s %9zu lines %9zu loaded %8.3f s %12.0f lines/s\n",
+				name, lines, loaded, seconds, lines / seconds);
+}
+
+int main(int argc, char* argv[]) {
+	size_t lines = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 500000;
+	string path = argc > 2 ? argv[2] : "manifest_bench.csv";
+	{
+		std::ofstream out(path);
+		for(size_t i = 0; i < lines; ++i) {
+			out << i % 100 << ',' << i / 100 % 100 << ",MSCU" << i
+				<< ",PORT" << i % 37 << ',' << 1000 + i % 29000 << '\n';
+		}
+	}
+
+	// one std::string per line and per field, one load per line
+	{
+		auto ship = makeShip();
+		auto started = std::chrono::steady_clock::now();
+		std::ifstream in(path);
+		string line, field;
+		size_t count = 0, loaded = 0;
+		while(std::getline(in, line)) {
+			++count;
+			std::vector<string> fields;
+			std::istringstream fieldStream(line);
+			while(std::getline(fieldStream, field, ',')) {
+				fields.push_back(field);
+			}
+			try {
+				ship.load(X{std::stoi(fields[0])}, Y{std::stoi(fields[1])},
+						  Cargo{fields[2], fields[3], std::stoi(fields[4])});
+				++loaded;
+			} catch(const BadShipOperationException&) {}
+		}
+		std::chrono::duration<double> seconds =
+			std::chrono::steady_clock::now() - started;
+		report("getline", count, loaded, seconds.count());
+	}
+
+	// mapped, string_view fields, parsing overlapped with loading
+	{
+		auto ship = makeShip();
+		ManifestImporter<Cargo> importer(
+			[](const ManifestImporter<Cargo>::Fields& f) {
+				int weight = 0;
+				std::from_chars(f[4].data(), f[4].data() + f[4].size(), weight);
+				return Cargo{ string(f[2]), string(f[3]), weight };
+			});
+		auto result = importer.importFile(ship, path);
+		std::chrono::duration<double> seconds = result.wall_time;
+		report("importer", result.lines, result.loaded, seconds.count());
+	}
+	std::remove(path.c_str());
+}
@@ -0,0 +1,42 @@
+#include "ShipReplay.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace shipping;
+
+// usage: ship_replay <trace> [--timed]
+// rebuilds the traced ship, with the cargo it had when recording started,
+// from the trace header and runs the trace against it, at full speed or,
+// with --timed, at the pace it was recorded
+
+int main(int argc, char* argv[]) {
+	if(argc < 2) {
+		std::fprintf(stderr, "usage: %s <trace> [--timed]\n", argv[0]);
+		return 2;
+	}
+	bool timed = argc > 2 && std::strcmp(argv[2], "--timed") == 0;
+	std::ifstream in(argv[1], std::ios::binary);
+	try {
+		TraceReader reader(in);
+		auto ship = makeReplayShip(reader.header());
+		auto report = replayTrace(reader, ship, TracedContainer::of, timed);
+
+		double seconds = std::chrono::duration<double>(report.wall_time).count();
+		auto us = [&](double p) {
+			return std::chrono::duration<double, std::micro>(
+				report.percentile(p)).count();
+		};
+		std::printf("calls      %zu (%zu failed, %zu differ from the trace)\n",
+					report.calls, report.failures, report.diverged);
+		std::printf("wall time  %.3f s, %.0f calls/s\n",
+					seconds, report.calls / seconds);
+		std::printf("latency    p50 %.2f us  p90 %.2f us  p99 %.2f us\n",
+					us(50), us(90), us(99));
+		return report.diverged == 0 ? 0 : 1;
+	} catch(const std::exception& e) {
+		std::fprintf(stderr, "%s: %s\n", argv[1], e.what());
+		return 2;
+	}
+}
@@ -0,0 +1,994 @@
+#include "CraneScheduler.h"
+#include "Fleet.h"
+#include "ManifestImporter.h"
+#include "Parallel.h"
+#include "Ship.h"
+#include "ShipReplay.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <string>
+#include <vector>
+
+using namespace shipping;
+using std::string;
+
+int failures = 0;
+
+void check(bool passed, const string& test) {
+	if(!passed) {
+		std::cout << "failed " << test << std::endl;
+		++failures;
+	}
+}
+
+Grouping<string> firstLetter() {
+	return {
+		{ "first_letter",
+			[](const string& s){ return string(1, s[0]); }
+		}
+	};
+}
+
+size_t countGroup(const Ship<string>& ship, const string& group) {
+	size_t count = 0;
+	for(const auto& entry : ship.getContainersViewByGroup("first_letter", group)) {
+		(void)entry;
+		++count;
+	}
+	return count;
+}
+
+void view_entries() {
+	Ship<string> ship{ X{4}, Y{4}, Height{4}, {}, firstLetter() };
+	ship.load(X{1}, Y{2}, "hello");
+	ship.load(X{1}, Y{2}, "hey");
+
+	std::vector<const string*> stacked;
+	for(const auto& container : ship.getContainersViewByPosition(X{1}, Y{2})) {
+		stacked.insert(stacked.begin(), &container);
+	}
+	// entries are values holding a reference to the container on board
+	size_t seen = 0;
+	auto view = ship.getContainersViewByGroup("first_letter", "h");
+	for(const auto& entry : view) {
+		const Position3D& pos = entry.first;
+		const string& container = entry.second;
+		check(std::get<0>(pos) == 1 && std::get<1>(pos) == 2 &&
+			  &container == stacked[std::get<2>(pos)],
+			  "group view entry refers to the container");
+		++seen;
+	}
+	for(auto&& entry : ship.getContainersViewByRegion(X{0}, Y{0}, X{3}, Y{3})) {
+		check(entry.second[0] == 'h', "region view entry");
+		++seen;
+	}
+	check(seen == 4, "view entries count");
+
+	// an entry outlives its iterator, and entries of two iterators are apart
+	const auto& first = *view.begin();
+	auto second_itr = view.begin();
+	++second_itr;
+	const auto& second = *second_itr;
+	check(&first.second != &second.second && first.first != second.first,
+		  "entries of different iterators");
+	check(first.second[0] == 'h' && second.second[0] == 'h', "entry outlives its iterator");
+
+	// standard algorithms take the view iterators
+	check(std::distance(view.begin(), view.end()) == 2, "distance over group view");
+	check(std::count_if(view.begin(), view.end(),
+						[](const auto& entry){ return entry.second == "hey"; }) == 1,
+		  "count_if over group view");
+	auto region = ship.getContainersViewByRegion(X{1}, Y{2}, X{1}, Y{2});
+	check(std::distance(region.begin(), region.end()) == 2, "distance over region view");
+	check(std::find_if(region.begin(), region.end(),
+					   [](const auto& entry){ return std::get<2>(entry.first) == 1; })->second == "hey",
+		  "find_if over region view");
+}
+
+void references_survive_loads() {
+	Ship<string> ship{ X{2}, Y{2}, Height{8}, {}, firstLetter() };
+	ship.load(X{0}, Y{0}, "bottom");
+	const string& bottom = *ship.getContainersViewByPosition(X{0}, Y{0}).begin();
+	const string* grouped = &(*ship.getContainersViewByGroup("first_letter", "b").begin()).second;
+	ship.load(X{0}, Y{0}, "middle");
+	ship.load(X{0}, Y{0}, "top");
+	for(int i = 0; i < 4; ++i) {
+		ship.load(X{0}, Y{0}, "more" + std::to_string(i));
+	}
+	check(bottom == "bottom" && grouped == &bottom, "references survive loads on the column");
+}
+
+void group_view_random_access() {
+	Ship<string> ship{ X{8}, Y{8}, Height{4}, {}, firstLetter() };
+	for(int x = 0; x < 8; ++x) {
+		for(int y = 0; y < 8; ++y) {
+			ship.load(X{x}, Y{y}, string(1, 'a' + (x + y) % 2) + std::to_string(x * 8 + y));
+		}
+	}
+	auto view = ship.getContainersViewByGroup("first_letter", "a");
+	using Iterator = decltype(view.begin());
+	static_assert(std::is_same_v<std::iterator_traits<Iterator>::iterator_category,
+								 std::random_access_iterator_tag>);
+	check(view.end() - view.begin() == 32 && view.begin() + 32 == view.end() &&
+		  32 + view.begin() == view.end() && view.end() - 32 == view.begin(),
+		  "group view iterator arithmetic");
+	std::vector<string> forward;
+	for(const auto& entry : view) {
+		forward.push_back(entry.second);
+	}
+	bool indexed = true;
+	for(size_t i = 0; i < forward.size(); ++i) {
+		indexed = indexed && view.begin()[i].second == forward[i] &&
+				  (*(view.end() - (32 - i))).second == forward[i];
+	}
+	check(indexed, "group view iterator indexing");
+	std::vector<string> backward;
+	for(auto itr = view.end(); itr != view.begin();) {
+		--itr;
+		backward.push_back(itr->second);
+	}
+	std::reverse(backward.begin(), backward.end());
+	check(backward == forward, "group view iterates backwards");
+	auto middle = view.begin() + 10;
+	check(view.begin() < middle && middle <= middle && middle > view.begin() &&
+		  view.end() >= middle && !(middle < middle), "group view iterator order");
+	std::reverse_iterator<Iterator> rbegin(view.end()), rend(view.begin());
+	check(rend - rbegin == 32 && rbegin[31].second == forward[0] &&
+		  std::count_if(rbegin, rend, [](const auto& entry){ return entry.second[0] == 'a'; }) == 32,
+		  "group view reverse iterators");
+	size_t chunked = 0;
+	for(const auto& chunk : view.split(5)) {
+		chunked += chunk.end() - chunk.begin();
+	}
+	check(chunked == 32, "split chunks cover the view");
+}
+
+void fork_and_copy_isolation() {
+	Ship<string> parent{ X{4}, Y{4}, Height{4}, {}, firstLetter() };
+	parent.load(X{0}, Y{0}, "alpha");
+	parent.load(X{1}, Y{1}, "beta");
+
+	auto fork = parent.fork();
+	Ship<string> copy = parent;
+
+	// parent writes are not seen by the fork or the copy
+	parent.load(X{0}, Y{0}, "apple");
+	parent.unload(X{1}, Y{1});
+	check(countGroup(parent, "a") == 2 && countGroup(parent, "b") == 0, "parent after write");
+	check(countGroup(fork, "a") == 1 && countGroup(fork, "b") == 1, "fork isolated from parent");
+	check(countGroup(copy, "a") == 1 && countGroup(copy, "b") == 1, "copy isolated from parent");
+
+	// and their writes are not seen by the parent or each other
+	fork.load(X{2}, Y{2}, "bravo");
+	copy.unload(X{0}, Y{0});
+	check(countGroup(parent, "a") == 2 && countGroup(parent, "b") == 0, "parent isolated from fork and copy");
+	check(countGroup(fork, "a") == 1 && countGroup(fork, "b") == 2, "fork after write");
+	check(countGroup(copy, "a") == 0 && countGroup(copy, "b") == 1, "copy after write");
+	check(*fork.getContainersViewByPosition(X{0}, Y{0}).begin() == "alpha" &&
+		  *parent.getContainersViewByPosition(X{0}, Y{0}).begin() == "apple",
+		  "fork keeps its own column");
+}
+
+std::vector<string> column(const Ship<string>& ship, int x, int y) {
+	std::vector<string> containers;
+	for(const auto& container : ship.getContainersViewByPosition(X{x}, Y{y})) {
+		containers.push_back(container);
+	}
+	return containers;
+}
+
+bool events_are(std::vector<DeltaEvent> events,
+				std::vector<std::tuple<DeltaKind, int, int, int>> expected) {
+	if(events.size() != expected.size()) {
+		return false;
+	}
+	for(size_t i = 0; i < events.size(); ++i) {
+		if(std::tuple{ events[i].kind, events[i].x, events[i].y, events[i].z } != expected[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void delta_streams() {
+	using K = DeltaKind;
+	Ship<string> ship{ X{4}, Y{4}, Height{8}, {}, firstLetter() };
+	ship.load(X{3}, Y{3}, "early");
+	auto group_a = ship.subscribeToGroup("first_letter", "a");
+	auto at_origin = ship.subscribeToPosition(X{0}, Y{0});
+	auto at_one = ship.subscribeToPosition(X{1}, Y{1});
+	auto unknown = ship.subscribeToGroup("no_such_grouping", "a");
+
+	ship.load(X{0}, Y{0}, "a1");
+	ship.load(X{0}, Y{0}, "b1");
+	ship.load(X{0}, Y{0}, "a2");
+	ship.move(X{0}, Y{0}, X{1}, Y{1});
+	ship.unload(X{1}, Y{1});
+	ship.unload(X{0}, Y{0});
+
+	std::vector<DeltaEvent> events;
+	check(group_a.poll(events), "group poll");
+	check(events_are(events, { { K::Insert, 0, 0, 0 }, { K::Insert, 0, 0, 2 },
+							   { K::Remove, 0, 0, 2 }, { K::Insert, 1, 1, 0 },
+							   { K::Remove, 1, 1, 0 } }),
+		  "group events on load, move and unload");
+	bool numbered = group_a.sequence() == 5;
+	for(size_t i = 0; i < events.size(); ++i) {
+		numbered = numbered && events[i].sequence == i;
+	}
+	check(numbered, "group events are numbered from the subscription");
+	events.clear();
+	check(at_origin.poll(events), "position poll");
+	check(events_are(events, { { K::Insert, 0, 0, 0 }, { K::Insert, 0, 0, 1 },
+							   { K::Insert, 0, 0, 2 }, { K::Remove, 0, 0, 2 },
+							   { K::Remove, 0, 0, 1 } }),
+		  "position events of the move source");
+	events.clear();
+	check(at_one.poll(events), "move target poll");
+	check(events_are(events, { { K::Insert, 1, 1, 0 }, { K::Remove, 1, 1, 0 } }),
+		  "position events of the move target");
+	events.clear();
+	check(group_a.poll(events) && events.empty(), "nothing new since the last poll");
+	check(unknown.poll(events) && events.empty(), "unknown grouping gets no events");
+
+	// a late subscriber starts at the head
+	auto late = ship.subscribeToGroup("first_letter", "a");
+	check(late.sequence() == 5, "late subscription starts at the head");
+
+	// lapped by more than capacity: false, then back in step from the head
+	auto small = ship.subscribeToPosition(X{2}, Y{2}, 4);
+	auto small_group = ship.subscribeToGroup("first_letter", "c", 4);
+	for(int i = 0; i < 4; ++i) {
+		ship.load(X{2}, Y{2}, "c" + std::to_string(i));
+	}
+	check(small.poll(events) && events.size() == 4, "exactly capacity behind");
+	events.clear();
+	ship.load(X{2}, Y{2}, "c4");
+	check(small.poll(events) && events_are(events, { { K::Insert, 2, 2, 4 } }),
+		  "poll after a poll");
+	events.clear();
+	check(!small_group.poll(events) && events.empty(), "lapped subscriber is told");
+	check(small_group.sequence() == 5, "lapped subscriber moves to the head");
+	ship.unload(X{2}, Y{2});
+	check(small_group.poll(events) && events_are(events, { { K::Remove, 2, 2, 4 } }),
+		  "lapped subscriber continues from the head");
+	events.clear();
+
+	// a fork writes to streams of its own, not to its parent's
+	auto parent_group = ship.subscribeToGroup("first_letter", "d");
+	auto parent_position = ship.subscribeToPosition(X{3}, Y{2});
+	Ship<string> fork = ship.fork();
+	auto fork_group = fork.subscribeToGroup("first_letter", "d");
+	fork.load(X{3}, Y{2}, "d1");
+	fork.unload(X{3}, Y{3});
+	check(parent_group.poll(events) && events.empty(), "fork does not publish to parent groups");
+	check(parent_position.poll(events) && events.empty(), "fork does not publish to parent positions");
+	check(fork_group.poll(events) && events_are(events, { { K::Insert, 3, 2, 0 } }),
+		  "fork publishes to its own streams");
+	events.clear();
+	ship.load(X{3}, Y{2}, "d2");
+	check(fork_group.poll(events) && events.empty(), "parent does not publish to fork streams");
+	check(parent_group.poll(events) && events_are(events, { { K::Insert, 3, 2, 0 } }),
+		  "parent still publishes after a fork");
+}
+
+void fleet_queries() {
+	// 5 ships round robin on 3 shards: ships 0 and 3, 1 and 4, then 2
+	Fleet<string> fleet(3);
+	std::vector<size_t> per_ship;
+	for(size_t id = 0; id < 5; ++id) {
+		Ship<string> ship{ X{4}, Y{4}, Height{4}, {}, firstLetter() };
+		size_t count = (id * 7) % 5 + id;
+		for(size_t i = 0; i < count; ++i) {
+			ship.load(X{int(i % 4)}, Y{int(i / 4)}, "a" + std::to_string(id * 100 + i));
+		}
+		ship.load(X{3}, Y{3}, "b" + std::to_string(id));
+		per_ship.push_back(count);
+		check(fleet.addShip(std::move(ship)) == id, "fleet ship id");
+	}
+	auto entries = fleet.getContainersByGroup("first_letter", "a");
+	std::vector<size_t> shard_order = { 0, 3, 1, 4, 2 };
+	std::vector<size_t> expected_ships;
+	for(auto id : shard_order) {
+		expected_ships.insert(expected_ships.end(), per_ship[id], id);
+	}
+	std::vector<size_t> ships;
+	bool refer = true;
+	for(const auto& entry : entries) {
+		ships.push_back(entry.ship);
+		auto [x, y, z] = entry.position;
+		const string& on_board = *fleet.ship(entry.ship).getContainersViewByPosition(X{x}, Y{y}).begin();
+		refer = refer && z == 0 && entry.container == &on_board &&
+				(*entry.container)[0] == 'a' && std::stoul(entry.container->substr(1)) / 100 == entry.ship;
+	}
+	check(ships == expected_ships, "fleet entries in shard slices");
+	check(refer, "fleet entries refer to the containers on board");
+
+	size_t total = 0;
+	size_t length = 0;
+	for(size_t id = 0; id < 5; ++id) {
+		total += per_ship[id];
+		for(const auto& entry : fleet.ship(id).getContainersViewByGroup("first_letter", "a")) {
+			length += entry.second.size();
+		}
+	}
+	check(fleet.countByGroup("first_letter", "a") == total, "fleet count by group");
+	check(fleet.countByGroup("first_letter", "b") == 5, "fleet count of one per ship");
+	check(fleet.countByGroup("first_letter", "z") == 0, "fleet count of an empty group");
+	check(fleet.reduceByGroup("first_letter", "a", size_t{1000},
+							  [](const Position3D&, const string& container) { return container.size(); },
+							  [](size_t a, size_t b) { return a + b; }) == 1000 + length,
+		  "fleet reduce by group combines init once");
+	check(fleet.reduceByGroup("first_letter", "z", size_t{7},
+							  [](const Position3D&, const string&) { return size_t{1}; },
+							  [](size_t a, size_t b) { return a + b; }) == 7,
+		  "fleet reduce of an empty group is init");
+	check(fleet.reduceByGroup("first_letter", "b", string{},
+							  [](const Position3D&, const string& container) { return container; },
+							  [](string a, const string& b) { return std::max(a, b); }) == "b4",
+		  "fleet reduce by group with a non numeric fold");
+	check(fleet.getContainersByGroup("first_letter", "z").empty(), "fleet entries of an empty group");
+}
+
+// small deterministic generator for the randomized index tests
+struct Lcg {
+	std::uint64_t state;
+	size_t next(size_t bound) {
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		return size_t(state >> 33) % bound;
+	}
+};
+
+void sorted_runs_match_multiset() {
+	SortedRuns<int> runs;
+	std::multiset<int> reference;
+	Lcg random{ 7 };
+	auto same = [&] {
+		return runs.size() == reference.size() &&
+			   std::equal(runs.begin(), runs.end(), reference.begin(), reference.end());
+	};
+	// grows far past one run of 128, with many duplicates
+	for(int i = 0; i < 3000; ++i) {
+		int value = int(random.next(500));
+		runs.insert(value);
+		reference.insert(value);
+	}
+	check(same(), "sorted runs after inserts");
+	// erases thin the runs out until they merge, mixed with more inserts
+	bool erased_agree = true;
+	for(int i = 0; i < 4000; ++i) {
+		int value = int(random.next(520));
+		if(random.next(3) == 0) {
+			runs.insert(value);
+			reference.insert(value);
+			continue;
+		}
+		auto itr = reference.find(value);
+		bool present = itr != reference.end();
+		if(present) {
+			reference.erase(itr);
+		}
+		erased_agree = erased_agree && runs.erase(value) == present;
+	}
+	check(erased_agree, "sorted runs erase finds what is there");
+	check(same(), "sorted runs after erases");
+	std::vector<int> backward;
+	for(auto itr = runs.end(); itr != runs.begin();) {
+		backward.push_back(*--itr);
+	}
+	check(std::equal(backward.begin(), backward.end(), reference.rbegin(), reference.rend()),
+		  "sorted runs iterate backwards");
+	bool bounds = true;
+	for(int value = -1; value <= 521; ++value) {
+		auto lower = runs.lower_bound(value);
+		auto upper = runs.upper_bound(value);
+		auto ref_lower = reference.lower_bound(value);
+		auto ref_upper = reference.upper_bound(value);
+		bounds = bounds &&
+				 std::distance(runs.begin(), lower) == std::distance(reference.begin(), ref_lower) &&
+				 std::distance(runs.begin(), upper) == std::distance(reference.begin(), ref_upper);
+	}
+	check(bounds, "sorted runs bounds");
+	while(!reference.empty()) {
+		runs.erase(*reference.begin());
+		reference.erase(reference.begin());
+	}
+	check(runs.empty() && runs.begin() == runs.end(), "sorted runs emptied");
+}
+
+void ordered_group_views() {
+	Grouping<string> groupings = {
+		{ "first_letter", [](const string& s) { return string(1, s[0]); } },
+		{ "all", [](const string&) { return string("all"); } }
+	};
+	Measures<string> measures = {
+		{ "weight", [](const string& s) { return std::stoll(s.substr(1)); } }
+	};
+	Ship<string> ship{ X{16}, Y{16}, Height{8}, {}, groupings, measures };
+	ship.orderGroupsBy("first_letter", "weight");
+	ship.orderGroupsBy("all");
+	Lcg random{ 11 };
+	for(int i = 0; i < 1500; ++i) {
+		int x = int(random.next(16));
+		int y = int(random.next(16));
+		if(ship.columnHeight(X{x}, Y{y}) < 8) {
+			ship.load(X{x}, Y{y}, "w" + std::to_string(random.next(300)));
+		}
+	}
+	for(int i = 0; i < 700; ++i) {
+		int x = int(random.next(16));
+		int y = int(random.next(16));
+		if(ship.columnHeight(X{x}, Y{y}) > 0) {
+			ship.unload(X{x}, Y{y});
+		}
+	}
+	using Keyed = std::pair<long long, Position3D>;
+	std::vector<Keyed> reference;
+	std::vector<Position3D> positions;
+	for(const auto& entry : ship.getContainersViewByGroup("first_letter", "w")) {
+		reference.push_back({ std::stoll(entry.second.substr(1)), entry.first });
+		positions.push_back(entry.first);
+	}
+	std::sort(reference.begin(), reference.end());
+	std::sort(positions.begin(), positions.end());
+	check(reference.size() > 256, "ordered view spans several runs");
+	auto keyed = [](const auto& view) {
+		std::vector<Keyed> entries;
+		for(auto itr = view.begin(); itr != view.end(); ++itr) {
+			check(itr.key() == std::stoll(itr->second.substr(1)), "ordered key is the measure");
+			entries.push_back({ itr.key(), itr->first });
+		}
+		return entries;
+	};
+	auto view = ship.getContainersViewByGroupOrdered("first_letter", "w");
+	check(keyed(view) == reference, "ordered view in measure order");
+	std::vector<Keyed> backward;
+	for(auto itr = view.end(); itr != view.begin();) {
+		--itr;
+		backward.push_back({ itr.key(), itr->first });
+	}
+	check(std::equal(backward.begin(), backward.end(), reference.rbegin(), reference.rend()),
+		  "ordered view iterates backwards");
+
+	for(auto [low, high] : std::vector<std::pair<long long, long long>>{
+			{ 0, 299 }, { 50, 60 }, { 100, 100 }, { -5, 3 }, { 290, 400 }, { 60, 50 }, { 400, 500 } }) {
+		std::vector<Keyed> expected;
+		for(const auto& entry : reference) {
+			if(low <= entry.first && entry.first <= high) {
+				expected.push_back(entry);
+			}
+		}
+		check(keyed(view.between(low, high)) == expected,
+			  "between " + std::to_string(low) + " and " + std::to_string(high));
+		for(size_t k : { size_t{0}, size_t{1}, size_t{7}, size_t{10000} }) {
+			std::vector<Keyed> top;
+			for(const auto& entry : view.between(low, high).topK(k)) {
+				top.push_back({ std::stoll(entry.second.substr(1)), entry.first });
+			}
+			std::vector<Keyed> expected_top(expected.rbegin(),
+											expected.rbegin() + std::min(k, expected.size()));
+			check(top == expected_top, "topK " + std::to_string(k) + " of between " +
+				  std::to_string(low) + " and " + std::to_string(high));
+		}
+	}
+
+	auto by_position = ship.getContainersViewByGroupOrdered("all", "all");
+	std::vector<Position3D> in_order;
+	for(const auto& entry : by_position) {
+		in_order.push_back(entry.first);
+	}
+	check(in_order == positions, "ordered view in position order");
+	Position3D low{ X{3}, Y{5}, Height{1} };
+	Position3D high{ X{9}, Y{2}, Height{0} };
+	std::vector<Position3D> expected;
+	for(const auto& pos : positions) {
+		if(!(pos < low) && !(high < pos)) {
+			expected.push_back(pos);
+		}
+	}
+	std::vector<Position3D> ranged;
+	for(const auto& entry : by_position.between(low, high)) {
+		ranged.push_back(entry.first);
+	}
+	check(!expected.empty() && ranged == expected, "between positions");
+	check(by_position.between(high, low).empty(), "between reversed positions");
+}
+
+void crane_batch_matches_sequential() {
+	using Op = CraneOperation<string>;
+	std::vector<Op> batch = {
+		Op::load(X{0}, Y{0}, "a1"), Op::load(X{1}, Y{0}, "b1"),
+		Op::load(X{0}, Y{0}, "a2"), Op::move(X{0}, Y{0}, X{2}, Y{2}),
+		Op::unload(X{1}, Y{0}), Op::unload(X{1}, Y{0}),  // second one fails
+		Op::load(X{3}, Y{3}, "d1"), Op::load(X{0}, Y{0}, "a3"),
+		Op::load(X{2}, Y{2}, "c1"), Op::move(X{3}, Y{3}, X{0}, Y{0}),
+		Op::load(X{3}, Y{1}, "blocked")  // restricted column
+	};
+	std::vector<std::tuple<X, Y, Height>> restrictions = {
+		{ X{3}, Y{1}, Height{0} }
+	};
+	Ship<string> batched{ X{4}, Y{4}, Height{4}, restrictions, firstLetter() };
+	Ship<string> sequential{ X{4}, Y{4}, Height{4}, restrictions, firstLetter() };
+
+	CraneScheduler<string> scheduler(3);
+	auto schedule = scheduler.run(batched, batch);
+
+	for(size_t op = 0; op < batch.size(); ++op) {
+		bool failed = false;
+		std::optional<string> unloaded;
+		try {
+			switch(batch[op].kind) {
+			case Op::Kind::Load:
+				sequential.load(batch[op].x, batch[op].y, *batch[op].container);
+				break;
+			case Op::Kind::Unload:
+				unloaded = sequential.unload(batch[op].x, batch[op].y);
+				break;
+			case Op::Kind::Move:
+				sequential.move(batch[op].x, batch[op].y, batch[op].to_x, batch[op].to_y);
+				break;
+			}
+		} catch(const BadShipOperationException&) {
+			failed = true;
+		}
+		check(schedule.errors[op].has_value() == failed, "batch error of op " + std::to_string(op));
+		check(schedule.unloaded[op] == unloaded, "batch unload of op " + std::to_string(op));
+	}
+	for(int x = 0; x < 4; ++x) {
+		for(int y = 0; y < 4; ++y) {
+			check(column(batched, x, y) == column(sequential, x, y), "batch column " +
+				  std::to_string(x) + "," + std::to_string(y));
+		}
+	}
+	for(string group : { "a", "b", "c", "d" }) {
+		check(countGroup(batched, group) == countGroup(sequential, group), "batch group " + group);
+	}
+	// unit durations on 3 cranes, longest remaining path first
+	check(schedule.makespan == 5, "batch makespan");
+	std::vector<int> start_times = { 0, 0, 1, 2, 1, 2, 0, 3, 3, 4, 1 };
+	check(schedule.start_times == start_times, "batch start times");
+}
+
+void crane_chains_in_parallel() {
+	using Op = CraneOperation<string>;
+	std::vector<Op> batch;
+	for(int round = 0; round < 6; ++round) {
+		for(int x = 0; x < 8; ++x) {
+			for(int y = 0; y < 8; ++y) {
+				if((x + y + round) % 4 == 3) {
+					batch.push_back(Op::unload(X{x}, Y{y}));
+				} else if((x * y + round) % 7 == 0) {
+					batch.push_back(Op::move(X{x}, Y{y}, X{7 - x}, Y{y}));
+				} else {
+					batch.push_back(Op::load(X{x}, Y{y}, string(1, 'a' + (x + round) % 4) +
+											 std::to_string(round * 64 + x * 8 + y)));
+				}
+			}
+		}
+	}
+	Ship<string> batched{ X{8}, Y{8}, Height{4}, {}, firstLetter() };
+	Ship<string> sequential{ X{8}, Y{8}, Height{4}, {}, firstLetter() };
+	CraneScheduler<string> scheduler(4);
+	auto schedule = scheduler.run(batched, batch);
+	CraneScheduler<string>(1).run(sequential, batch);
+	size_t errors = 0;
+	for(const auto& error : schedule.errors) {
+		errors += error.has_value();
+	}
+	check(errors > 0 && errors < batch.size(), "parallel batch has some errors");
+	for(int x = 0; x < 8; ++x) {
+		for(int y = 0; y < 8; ++y) {
+			check(column(batched, x, y) == column(sequential, x, y), "parallel batch column " +
+				  std::to_string(x) + "," + std::to_string(y));
+		}
+	}
+	for(string group : { "a", "b", "c", "d" }) {
+		check(countGroup(batched, group) == countGroup(sequential, group),
+			  "parallel batch group " + group);
+	}
+	check(batched.countContainersByRegion(X{0}, Y{0}, X{7}, Y{7}) == sequential.countContainersByRegion(X{0}, Y{0}, X{7}, Y{7}),
+		  "parallel batch region index");
+}
+
+void nested_parallel_scans() {
+	Ship<string> ship{ X{8}, Y{8}, Height{4}, {}, firstLetter() };
+	for(int x = 0; x < 8; ++x) {
+		for(int y = 0; y < 8; ++y) {
+			ship.load(X{x}, Y{y}, string(1, 'a' + (x + y) % 3) + std::to_string(x * 8 + y));
+		}
+	}
+	// every outer task waits on a scan of its own; with pool wide waits the
+	// two workers ended up waiting on each other's outer tasks
+	ThreadPool pool(2);
+	std::atomic<size_t> pairs{0};
+	parallel_for_each(ship, [&](const string& outer) {
+		parallel_for_each(ship.getContainersViewByGroup("first_letter", string(1, outer[0])),
+			[&](const auto&) { ++pairs; }, pool);
+	}, pool);
+	size_t expected = 0;
+	for(string group : { "a", "b", "c" }) {
+		expected += countGroup(ship, group) * countGroup(ship, group);
+	}
+	check(pairs == expected, "nested parallel scan");
+}
+
+void pool_callers_keep_their_errors() {
+	ThreadPool pool(2);
+	std::atomic<bool> thrown{false};
+	bool other_failed = false;
+	std::thread other([&] {
+		TaskGroup group;
+		// the waiters run queued tasks of any group, so every thread may pick
+		// one of these up before the throwing task: bound the wait
+		for(int i = 0; i < 100; ++i) {
+			pool.submit(group, [&thrown] {
+				auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+				while(!thrown && std::chrono::steady_clock::now() < deadline) {
+					std::this_thread::yield();
+				}
+			});
+		}
+		try {
+			pool.wait(group);
+		} catch(...) {
+			other_failed = true;
+		}
+	});
+	TaskGroup group;
+	pool.submit(group, [&thrown] {
+		thrown = true;
+		throw std::runtime_error("mine");
+	});
+	bool caught = false;
+	try {
+		pool.wait(group);
+	} catch(const std::runtime_error&) {
+		caught = true;
+	}
+	other.join();
+	check(caught, "task error reaches its own caller");
+	check(!other_failed, "task error stays with its own caller");
+}
+
+template <typename Operation>
+bool rejected(Operation operation) {
+	try {
+		operation();
+	} catch(const BadShipOperationException&) {
+		return true;
+	}
+	return false;
+}
+
+void segregation_constraints() {
+	Ship<string> ship{ X{4}, Y{4}, Height{4}, {}, firstLetter() };
+	ship.addSegregationConstraint({ "first_letter", "a", "b", 1 });
+	ship.load(X{0}, Y{0}, "alpha");
+
+	// a rejected load leaves the ship as it was
+	check(rejected([&]{ ship.load(X{1}, Y{1}, "bravo"); }), "segregated load rejected");
+	check(column(ship, 1, 1).empty() && countGroup(ship, "b") == 0, "rejected load not on board");
+	ship.load(X{2}, Y{2}, "bravo");
+	ship.load(X{0}, Y{0}, "anchor");
+
+	// a rejected move puts the container back on top of its origin
+	check(rejected([&]{ ship.move(X{2}, Y{2}, X{1}, Y{0}); }), "segregated move rejected");
+	check(column(ship, 2, 2) == std::vector<string>{ "bravo" } && column(ship, 1, 0).empty(),
+		  "rejected move back at its origin");
+	check(countGroup(ship, "b") == 1, "rejected move keeps its group");
+	ship.move(X{2}, Y{2}, X{3}, Y{3});
+	check(column(ship, 3, 3) == std::vector<string>{ "bravo" }, "move away from segregated group");
+
+	// a group kept apart from itself: no two of its members within distance 0
+	Ship<string> apart{ X{4}, Y{4}, Height{4}, {}, firstLetter() };
+	apart.load(X{0}, Y{0}, "alpha");
+	apart.addSegregationConstraint({ "first_letter", "a", "a", 0 });
+	check(rejected([&]{ apart.load(X{0}, Y{0}, "apple"); }), "self segregated load rejected");
+	apart.load(X{0}, Y{1}, "apple");
+	apart.load(X{0}, Y{0}, "bravo");
+	check(countGroup(apart, "a") == 2 && column(apart, 0, 0).size() == 2, "self segregation allows others");
+
+	// a constraint the cargo on board already breaks is not added
+	Ship<string> broken{ X{4}, Y{4}, Height{4}, {}, firstLetter() };
+	broken.load(X{0}, Y{0}, "alpha");
+	broken.load(X{0}, Y{1}, "bravo");
+	broken.load(X{3}, Y{3}, "apple");
+	broken.load(X{3}, Y{3}, "avocado");
+	check(rejected([&]{ broken.addSegregationConstraint({ "first_letter", "a", "b", 1 }); }),
+		  "broken constraint rejected");
+	check(rejected([&]{ broken.addSegregationConstraint({ "first_letter", "a", "a", 0 }); }),
+		  "broken self constraint rejected");
+	check(broken.segregationDistance() == -1, "broken constraints not added");
+	broken.load(X{1}, Y{1}, "banana");
+	check(rejected([&]{ broken.addSegregationConstraint({ "no_such_grouping", "a", "b", 1 }); }),
+		  "constraint of unknown grouping rejected");
+	broken.addSegregationConstraint({ "first_letter", "a", "b", 0 });
+	check(broken.segregationDistance() == 0, "kept constraint added");
+}
+
+ManifestImporter<string> idImporter(size_t chunk_bytes) {
+	return ManifestImporter<string>([](const ManifestImporter<string>::Fields& fields) {
+		if(fields.size() != 3) {
+			throw std::invalid_argument("bad field count");
+		}
+		return string(fields[2]);
+	}, ',', 2, chunk_bytes);
+}
+
+void manifest_errors_by_line() {
+	std::vector<std::tuple<X, Y, Height>> restrictions = { { X{1}, Y{1}, Height{0} } };
+	Ship<string> ship{ X{2}, Y{2}, Height{2}, restrictions, firstLetter() };
+	string manifest =
+		"# x,y,id\n"            // 1
+		"0,0,alpha\n"           // 2
+		"zz,0,bad\n"            // 3: bad x
+		"1,1,blocked\n"         // 4: restricted
+		"\n"                    // 5
+		"0,0,bravo\n"           // 6
+		"0,0,charlie\n"         // 7: column full
+		"0,1\n"                 // 8: too few fields
+		"1,0,delta,extra\n"     // 9: makeContainer throws
+		"5,5,echo\n"            // 10: off the ship
+		"1,0,foxtrot";          // 11
+	for(size_t chunk_bytes : { size_t{1}, size_t{16}, size_t{1} << 20 }) {
+		Ship<string> target = ship;
+		auto report = idImporter(chunk_bytes).import(target, manifest);
+		std::vector<size_t> lines;
+		for(const auto& error : report.errors) {
+			lines.push_back(error.line);
+		}
+		string name = " with chunks of " + std::to_string(chunk_bytes);
+		check(report.lines == 11 && report.loaded == 3, "manifest counts" + name);
+		check(lines == std::vector<size_t>{ 3, 4, 7, 8, 9, 10 }, "manifest error lines" + name);
+		check(report.errors.size() == 6 && report.errors[4].message == "bad field count",
+			  "manifest error message" + name);
+		check(column(target, 0, 0) == std::vector<string>{ "bravo", "alpha" } &&
+			  column(target, 1, 0) == std::vector<string>{ "foxtrot" }, "manifest loaded" + name);
+	}
+}
+
+void manifest_load_throws() {
+	// a grouping that throws is not a rejected load: the import stops and
+	// rethrows, after its parse tasks are done with the chunks
+	Grouping<string> throwing = {
+		{ "first_letter", [](const string& s) {
+			if(s == "boom") {
+				throw std::runtime_error("grouping failed");
+			}
+			return string(1, s[0]);
+		} }
+	};
+	string manifest;
+	for(int i = 0; i < 2000; ++i) {
+		manifest += std::to_string(i % 8) + "," + std::to_string(i / 8 % 8) + "," +
+					(i == 50 ? "boom" : "c" + std::to_string(i)) + "\n";
+	}
+	auto importer = idImporter(64);
+	for(int round = 0; round < 20; ++round) {
+		Ship<string> ship{ X{8}, Y{8}, Height{64}, {}, throwing };
+		bool thrown = false;
+		try {
+			importer.import(ship, manifest);
+		} catch(const std::runtime_error& e) {
+			thrown = string(e.what()) == "grouping failed";
+		}
+		check(thrown, "manifest load error rethrown");
+		check(countGroup(ship, "c") == 50, "manifest stops at the load error");
+	}
+}
+
+void manifest_parse_failure_stops() {
+	// makeContainer throwing something other than std::exception fails the
+	// import; chunks after the window in flight are never parsed
+	std::atomic<size_t> made{0};
+	ManifestImporter<string> importer([&made](const ManifestImporter<string>::Fields& fields) {
+		++made;
+		if(fields[2] == "boom") {
+			throw 42;
+		}
+		return string(fields[2]);
+	}, ',', 2, 64);
+	string manifest;
+	for(int i = 0; i < 2000; ++i) {
+		manifest += std::to_string(i % 8) + "," + std::to_string(i / 8 % 8) + "," +
+					(i == 3 ? "boom" : "c" + std::to_string(i)) + "\n";
+	}
+	Ship<string> ship{ X{8}, Y{8}, Height{64}, {}, firstLetter() };
+	bool thrown = false;
+	try {
+		importer.import(ship, manifest);
+	} catch(int) {
+		thrown = true;
+	}
+	check(thrown, "manifest parse failure rethrown");
+	check(made < 100, "manifest stops submitting chunks after a failure");
+	check(countGroup(ship, "c") == 0, "manifest loads nothing of a failed chunk");
+}
+
+struct Box {
+	string id;
+	int height;
+};
+
+void mixed_heights() {
+	Grouping<Box> byLetter = {
+		{ "first_letter", [](const Box& b){ return string(1, b.id[0]); } }
+	};
+	Measures<Box> measures = {
+		{ "height", [](const Box& b){ return (long long)b.height; } }
+	};
+	// half feet: 8'6" and 9'6" boxes are 17 and 19, the ship is 20 feet high
+	Ship<Box> ship{ X{3}, Y{3}, Height{40}, { { X{1}, Y{1}, Height{20} } }, byLetter, measures,
+					[](const Box& b){ return b.height; } };
+	ship.load(X{0}, Y{0}, Box{ "a1", 19 });
+	ship.load(X{0}, Y{0}, Box{ "a2", 17 });
+	check(rejected([&]{ ship.load(X{0}, Y{0}, Box{ "a3", 5 }); }), "box over the ship height rejected");
+	ship.load(X{0}, Y{0}, Box{ "a4", 4 });
+	check(ship.columnHeight(X{0}, Y{0}) == 40, "column height of mixed boxes");
+
+	ship.load(X{1}, Y{1}, Box{ "b1", 17 });
+	ship.load(X{1}, Y{1}, Box{ "b2", 3 });
+	check(rejected([&]{ ship.load(X{1}, Y{1}, Box{ "b3", 1 }); }), "box over the restriction rejected");
+	check(ship.columnHeight(X{1}, Y{1}) == 20, "column height up to the restriction");
+
+	check(ship.unload(X{0}, Y{0}).id == "a4" && ship.columnHeight(X{0}, Y{0}) == 36,
+		  "column height after unload");
+	ship.unload(X{0}, Y{0});
+	check(ship.columnHeight(X{0}, Y{0}) == 19, "column height after second unload");
+	ship.load(X{0}, Y{0}, Box{ "a5", 21 });
+	check(ship.columnHeight(X{0}, Y{0}) == 40, "column height after reload");
+
+	// a column of the thinnest boxes stacks as many containers as sub-units
+	auto before = ship.fork();
+	for(int i = 0; i < 40; ++i) {
+		ship.load(X{2}, Y{2}, Box{ "c" + std::to_string(i), 1 });
+	}
+	check(rejected([&]{ ship.load(X{2}, Y{2}, Box{ "c40", 1 }); }), "thin box over the ship height rejected");
+	check(ship.countContainersByRegion(X{0}, Y{0}, X{2}, Y{2}) == 44, "region count of mixed boxes");
+	check(ship.countContainersByRegion(X{2}, Y{2}, Height{30}, X{2}, Y{2}, Height{39}) == 10,
+		  "region count high in a column");
+	check(ship.sumByRegion("height", X{0}, Y{0}, X{2}, Y{2}) == 100, "region sum of mixed boxes");
+	check(before.countContainersByRegion(X{0}, Y{0}, X{2}, Y{2}) == 4 &&
+		  before.sumByRegion("height", X{0}, Y{0}, X{2}, Y{2}) == 60, "fork keeps its region index");
+}
+
+// as the replay tool rebuilds it: the recorded groups, measures and height
+void trace_round_trip() {
+	Grouping<Box> byLetter = {
+		{ "first_letter", [](const Box& b){ return string(1, b.id[0]); } }
+	};
+	Measures<Box> measures = {
+		{ "height", [](const Box& b){ return (long long)b.height; } }
+	};
+	Ship<Box> ship{ X{4}, Y{4}, Height{40}, { { X{3}, Y{3}, Height{20} } }, byLetter, measures,
+					[](const Box& b){ return b.height; } };
+	// on board before recording starts
+	ship.load(X{0}, Y{0}, Box{ "alpha", 19 });
+	ship.load(X{0}, Y{0}, Box{ "anchor", 17 });
+	ship.load(X{2}, Y{2}, Box{ "bravo", 19 });
+	ship.addSegregationConstraint({ "first_letter", "a", "b", 1 });
+	ship.orderGroupsBy("first_letter", "height");
+
+	std::stringstream trace;
+	ship.startTrace(trace);
+	int failed = 0;
+	auto call = [&](auto operation) {
+		try {
+			operation();
+		} catch(const BadShipOperationException&) {
+			++failed;
+		}
+	};
+	call([&]{ ship.unload(X{0}, Y{0}); });                    // cargo from before
+	call([&]{ ship.load(X{0}, Y{0}, Box{ "able", 22 }); });   // too high with the cargo
+	call([&]{ ship.load(X{1}, Y{1}, Box{ "beta", 17 }); });   // segregated from alpha
+	call([&]{ ship.move(X{2}, Y{2}, X{3}, Y{3}); });
+	call([&]{ ship.load(X{3}, Y{3}, Box{ "big", 4 }); });     // over the restriction
+	call([&]{ ship.load(X{1}, Y{3}, Box{ "cargo", 17 }); });
+	call([&]{ ship.addSegregationConstraint({ "first_letter", "c", "c", 0 }); });
+	call([&]{ ship.load(X{1}, Y{3}, Box{ "crate", 17 }); });  // kept apart from cargo
+	call([&]{ ship.orderGroupsBy("first_letter"); });
+	call([&]{ ship.orderGroupsBy("first_letter", "weight"); }); // no such measure
+	call([&]{ ship.getContainersViewByGroup("first_letter", "a"); });
+	call([&]{ ship.getContainersViewByPosition(X{0}, Y{0}); });
+	call([&]{ for(const auto& box : ship) { (void)box; } });
+	call([&]{ ship.unload(X{0}, Y{0}); });
+	call([&]{ ship.unload(X{0}, Y{0}); });                    // empty by now
+	ship.stopTrace();
+	check(failed == 6, "trace round trip failures recorded");
+
+	TraceReader reader(trace);
+	check(reader.header().cargo.size() == 3 && reader.header().segregations.size() == 1 &&
+		  reader.header().orderings.size() == 1, "trace header state");
+	auto replayed = makeReplayShip(reader.header());
+	auto report = replayTrace(reader, replayed, TracedContainer::of);
+	check(report.calls == 15 && report.failures == 6, "trace replay calls");
+	check(report.diverged == 0, "trace replay diverged");
+	for(int x = 0; x < 4; ++x) {
+		for(int y = 0; y < 4; ++y) {
+			check(ship.columnHeight(X{x}, Y{y}) == replayed.columnHeight(X{x}, Y{y}),
+				  "trace replay column " + std::to_string(x) + "," + std::to_string(y));
+		}
+	}
+	check(ship.sumByRegion("height", X{0}, Y{0}, X{3}, Y{3}) ==
+		  replayed.sumByRegion("height", X{0}, Y{0}, X{3}, Y{3}), "trace replay measures");
+	check(replayed.segregationDistance() == 1, "trace replay constraints");
+	size_t ordered = 0;
+	for(const auto& entry : replayed.getContainersViewByGroupOrdered("first_letter", "c")) {
+		(void)entry;
+		++ordered;
+	}
+	check(ordered == 1, "trace replay orderings");
+
+	// only the current trace version is read
+	std::stringstream old_trace;
+	std::uint32_t old_version = 1;
+	old_trace.write("SHTR", 4);
+	old_trace.write(reinterpret_cast<const char*>(&old_version), sizeof(old_version));
+	bool rejected_version = false;
+	try {
+		TraceReader old_reader(old_trace);
+	} catch(const std::runtime_error&) {
+		rejected_version = true;
+	}
+	check(rejected_version, "trace of an old version rejected");
+}
+
+void interned_groups_cached() {
+	using Code = Interned<string>;
+	size_t calls = 0;
+	Grouping<Code> counted = {
+		{ "first_letter", [&calls](const string& s){ ++calls; return string(1, s[0]); } }
+	};
+	// handles from all over the pool, the cache holds only what this ship saw
+	for(int i = 0; i < 1000; ++i) {
+		Code("elsewhere" + std::to_string(i));
+	}
+	Ship<Code> ship{ X{2}, Y{2}, Height{4}, {}, counted };
+	ship.load(X{0}, Y{0}, Code("returning"));
+	ship.load(X{0}, Y{0}, Code("other"));
+	check(calls == 2, "interned groups computed once per payload");
+	ship.move(X{0}, Y{0}, X{1}, Y{1});
+	ship.unload(X{0}, Y{0});
+	ship.load(X{1}, Y{0}, Code("returning"));
+	ship.load(X{0}, Y{0}, Code("returning"));
+	check(calls == 2, "returning container skips its groups");
+	check(ship.getContainersViewByGroup("first_letter", "r").size() == 2, "returning container grouped");
+	check(ship.getContainersViewByGroup("first_letter", "o").size() == 1, "moved container grouped");
+	ship.load(X{1}, Y{1}, Code("fresh"));
+	check(calls == 3, "new payload grouped once");
+}
+
+int main() {
+	view_entries();
+	references_survive_loads();
+	group_view_random_access();
+	fork_and_copy_isolation();
+	delta_streams();
+	fleet_queries();
+	sorted_runs_match_multiset();
+	ordered_group_views();
+	crane_batch_matches_sequential();
+	crane_chains_in_parallel();
+	nested_parallel_scans();
+	pool_callers_keep_their_errors();
+	segregation_constraints();
+	manifest_errors_by_line();
+	manifest_load_throws();
+	manifest_parse_failure_stops();
+	mixed_heights();
+	trace_round_trip();
+	interned_groups_cached();
+	if(failures == 0) {
+		std::cout << "all ship tests passed" << std::endl;
+	}
+	return failures == 0 ? 0 : 1;
+}